@@ -0,0 +1,35 @@
+#include "Coroutine.hpp"
+
+#include <iostream>
+
+using namespace socketio;
+
+task<void> session(event_loop& loop, tcp_socket sock) {
+  co_await async_write(loop, sock, "FOO\n");
+  try {
+    while (true) {
+      std::string line = co_await async_read_line(loop, sock);
+      std::cout << line << "\n";
+      co_await async_write(loop, sock, line + "\n");
+    }
+  } catch (const socket_exception&) {
+    std::cout << "socket closed\n";
+  }
+}
+
+task<void> serve(event_loop& loop, tcp_server_socket& server) {
+  while (true) {
+    auto sock = co_await async_accept(loop, server);
+    std::cout << "accepted socket\n";
+    spawn(session(loop, std::move(sock)));
+  }
+}
+
+int main(int argc, char** argv) {
+  event_loop        loop{};
+  tcp_server_socket server{ "1234" };
+  server.set_blocking(false);
+  std::cout << "listening\n";
+  spawn(serve(loop, server));
+  loop.run();
+}
@@ -0,0 +1,28 @@
+#include "EventLoop.hpp"
+
+#include <iostream>
+
+int main(int argc, char** argv) {
+  socketio::event_loop  loop{};
+  socketio::tcp_reactor reactor{ loop, "1234" };
+  std::cout << "listening\n";
+
+  reactor.on_accept([&](socketio::tcp_socket& sock) {
+    std::cout << "accepted socket (" << reactor.size() << " open)\n";
+    sock.write("FOO\n");
+  });
+  reactor.on_readable([&](socketio::tcp_socket& sock) {
+    socketio::byte buffer[4096];
+    int            read{ 0 };
+    while ((read = sock.read(buffer, sizeof(buffer))) > 0) {
+      std::cout.write((const char*) buffer, read);
+    }
+    if (read == 0) {
+      reactor.close(sock);
+    }
+  });
+  reactor.on_closed([](socketio::tcp_socket&) {
+    std::cout << "socket closed\n";
+  });
+  loop.run();
+}
@@ -0,0 +1,37 @@
+#include "Socket.hpp"
+
+#include <iostream>
+#include <thread>
+
+using namespace socketio;
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: tls_server <cert.pem> <key.pem>\n";
+    return 1;
+  }
+  tls_context ctx{ TLS_SERVER };
+  ctx.use_certificate(argv[1], argv[2]);
+  ctx.set_alpn({ "http/1.1" });
+
+  tcp_server_socket server{ "1234" };
+  std::cout << "listening\n";
+  while (true) {
+    auto sock = server.accept();
+    // the handshake runs on its own thread so accept() isn't held up
+    std::thread{ [ctx, sock = std::move(sock)]() mutable {
+      try {
+        sock.set_timeout(5000);
+        sock.ssl_handshake(ctx);
+        std::cout << "handshake done, sni: " << sock.server_name()
+                  << ", alpn: " << sock.alpn_protocol() << "\n";
+        sock.write("FOO\n");
+        std::cout << sock.readLine() << "\n";
+      } catch (const ssl_exception& e) {
+        std::cout << e.what() << "\n";
+      } catch (const socket_exception& e) {
+        std::cout << e.what() << "\n";
+      }
+    } }.detach();
+  }
+}
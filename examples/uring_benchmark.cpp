@@ -0,0 +1,63 @@
+#include "Uring.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace socketio;
+
+namespace {
+constexpr int    connections  = 64;
+constexpr int    rounds       = 2000;
+constexpr size_t message_size = 64;
+
+double per_second(std::chrono::steady_clock::duration d, int messages) {
+  return messages / std::chrono::duration<double>(d).count();
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  tcp_server_socket server{ "1235" };
+
+  std::vector<tcp_socket> clients(connections);
+  std::vector<tcp_socket> peers(connections);
+  for (int i = 0; i < connections; ++i) {
+    clients[i].connect("localhost", "1235");
+    while (!server.try_accept(peers[i]))
+      ;
+  }
+
+  byte              message[message_size]{};
+  std::vector<byte> buffers(connections * message_size);
+  const int         messages = connections * rounds;
+
+  // one send and one recv syscall per message
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < connections; ++i) {
+      clients[i].write(message, message_size);
+      peers[i].read(&buffers[i * message_size], message_size);
+    }
+  }
+  auto plain = std::chrono::steady_clock::now() - start;
+
+  // all sends and receives of a round share io_uring_enter calls
+  uring ring{ 2 * connections };
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < connections; ++i) {
+      ring.write(clients[i], message, message_size, [](int) {});
+      ring.read(peers[i], &buffers[i * message_size], message_size,
+                [](int) {});
+    }
+    ring.run();
+  }
+  auto batched = std::chrono::steady_clock::now() - start;
+
+  std::cout << "io_uring: " << (ring.is_supported() ? "yes" : "no (fallback)")
+            << ", multishot: " << (ring.has_multishot() ? "yes" : "no")
+            << "\n";
+  std::cout << "send/recv: " << per_second(plain, messages) << " msg/s\n";
+  std::cout << "uring:     " << per_second(batched, messages) << " msg/s\n";
+}
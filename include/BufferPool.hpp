@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace socketio {
+/**
+ * @brief slab allocator for I/O buffers with fixed power of two size classes
+ * @note every thread keeps a small cache per size class, so allocations
+ * rarely touch the shared lists (and their mutex); blocks may be freed on
+ * any thread. Memory stays with the pool until it is destroyed.
+ * @note usable with any pmr container, e.g. std::pmr::string or
+ * std::pmr::vector<byte>
+ */
+class buffer_pool : public std::pmr::memory_resource {
+  struct state;
+  struct thread_cache;
+  std::shared_ptr<state> state_;
+
+  thread_cache* local_cache() const;
+
+protected:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void  do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool  do_is_equal(const std::pmr::memory_resource& other) const noexcept
+      override;
+
+public:
+  /**
+   * @brief smallest block handed out
+   *
+   */
+  static constexpr size_t min_block_size = 64;
+  /**
+   * @brief larger requests go straight to the upstream resource
+   *
+   */
+  static constexpr size_t max_block_size = 64 * 1024;
+
+  /**
+   * @brief
+   *
+   * @param upstream where slabs (and oversized blocks) come from
+   * @param thread_cache_size blocks per size class a thread keeps for itself
+   */
+  explicit buffer_pool(
+      std::pmr::memory_resource* upstream = std::pmr::new_delete_resource(),
+      size_t                     thread_cache_size = 32);
+  ~buffer_pool();
+
+  buffer_pool(const buffer_pool&)            = delete;
+  buffer_pool& operator=(const buffer_pool&) = delete;
+
+  /**
+   * @brief process wide pool used by socket buffers
+   * @note never destroyed, so it can be used during static destruction
+   * @return buffer_pool&
+   */
+  static buffer_pool& global();
+
+  /**
+   * @brief resource slabs are taken from
+   *
+   * @return std::pmr::memory_resource*
+   */
+  std::pmr::memory_resource* upstream() const;
+  /**
+   * @brief bytes taken from the upstream resource for slabs
+   *
+   * @return size_t
+   */
+  size_t reserved() const;
+};
+} // namespace socketio
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Socket.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace socketio {
+/**
+ * @brief keeps idle client connections per host and port for reuse
+ * @note thread safe; connections are checked before reuse and dropped once
+ * they idled longer than the idle timeout
+ */
+class connection_pool {
+  struct state;
+  std::shared_ptr<state> state_;
+
+public:
+  /**
+   * @brief socket borrowed from the pool, returned when destroyed
+   * @note closed sockets and discard()ed ones are not returned
+   */
+  class connection {
+    friend class connection_pool;
+
+    std::shared_ptr<state> pool_;
+    std::string            key_;
+    tcp_socket             sock_;
+    bool                   reused_;
+
+    connection(std::shared_ptr<state> pool, std::string key, tcp_socket sock,
+               bool reused);
+
+  public:
+    connection(connection&& other) noexcept;
+    connection& operator=(connection&& other) noexcept;
+    ~connection();
+
+    connection(const connection&)            = delete;
+    connection& operator=(const connection&) = delete;
+
+    tcp_socket& operator*();
+    tcp_socket* operator->();
+
+    /**
+     * @brief was the socket used before (no connect or handshake needed)
+     *
+     * @return true
+     * @return false
+     */
+    bool reused() const;
+    /**
+     * @brief closes the socket instead of returning it, e.g. after a
+     * protocol error left it in an unknown state
+     *
+     */
+    void discard();
+  };
+
+  /**
+   * @brief creates an empty pool
+   *
+   * @param max_per_host open connections (idle and borrowed) per host and port
+   * @param idle_timeout idle connections older than this are closed
+   */
+  explicit connection_pool(
+      size_t                    max_per_host = 8,
+      std::chrono::milliseconds idle_timeout = std::chrono::seconds{ 60 });
+  /**
+   * @brief closes the idle connections; borrowed ones are closed when
+   * returned
+   *
+   */
+  ~connection_pool();
+
+  connection_pool(const connection_pool&)            = delete;
+  connection_pool& operator=(const connection_pool&) = delete;
+
+  /**
+   * @brief perform a tls handshake with ctx on new connections
+   *
+   * @param ctx client context, shares its session cache
+   */
+  void set_tls(const tls_context& ctx);
+
+  /**
+   * @brief borrows an idle connection or connects a new one
+   * @note waits for a returned connection if max_per_host are open
+   * @param domain
+   * @param port
+   * @param timeout_ms how long to wait for a free slot, -1 waits forever
+   * @return connection throws socket_exception if connecting fails or the
+   * timeout passes
+   */
+  connection acquire(const std::string& domain, const std::string& port,
+                     int timeout_ms = -1);
+
+  /**
+   * @brief closes idle connections older than the idle timeout
+   * @note acquire() does this for the host it connects to
+   */
+  void evict_idle();
+  /**
+   * @brief closes all idle connections
+   *
+   */
+  void clear();
+
+  /**
+   * @brief number of idle connections over all hosts
+   *
+   * @return size_t
+   */
+  size_t idle() const;
+  /**
+   * @brief number of open connections (idle and borrowed) over all hosts
+   *
+   * @return size_t
+   */
+  size_t open() const;
+};
+} // namespace socketio
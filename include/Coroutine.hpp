@@ -0,0 +1,362 @@
+#pragma once
+
+#include "EventLoop.hpp"
+#include "Framing.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace socketio {
+template <typename T>
+class task;
+
+/**
+ * @brief state shared by all task promises
+ *
+ */
+class task_promise_base {
+  std::coroutine_handle<> continuation_{ std::noop_coroutine() };
+
+protected:
+  std::exception_ptr error_{};
+
+public:
+  struct final_awaiter {
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> h) const noexcept {
+      // resume whoever awaited the task without growing the stack
+      return h.promise().continuation_;
+    }
+
+    void await_resume() const noexcept {
+    }
+  };
+
+  std::suspend_always initial_suspend() const noexcept {
+    return {};
+  }
+
+  final_awaiter final_suspend() const noexcept {
+    return {};
+  }
+
+  void unhandled_exception() noexcept {
+    error_ = std::current_exception();
+  }
+
+  void set_continuation(std::coroutine_handle<> continuation) noexcept {
+    continuation_ = continuation;
+  }
+};
+
+template <typename T>
+class task_promise : public task_promise_base {
+  std::optional<T> value_{};
+
+public:
+  void return_value(T value) {
+    value_.emplace(std::move(value));
+  }
+
+  T result() {
+    if (error_)
+      std::rethrow_exception(error_);
+    return std::move(*value_);
+  }
+};
+
+template <>
+class task_promise<void> : public task_promise_base {
+public:
+  void return_void() const noexcept {
+  }
+
+  void result() {
+    if (error_)
+      std::rethrow_exception(error_);
+  }
+};
+
+/**
+ * @brief lazily started coroutine that produces a T when awaited
+ *
+ * @tparam T
+ */
+template <typename T = void>
+class [[nodiscard]] task {
+public:
+  struct promise_type : task_promise<T> {
+    task get_return_object() noexcept {
+      return task{ std::coroutine_handle<promise_type>::from_promise(*this) };
+    }
+  };
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+
+  struct awaiter {
+    std::coroutine_handle<promise_type> handle;
+
+    bool await_ready() const noexcept {
+      return !handle || handle.done();
+    }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      handle.promise().set_continuation(awaiting);
+      return handle;
+    }
+
+    T await_resume() {
+      return handle.promise().result();
+    }
+  };
+
+public:
+  explicit task(std::coroutine_handle<promise_type> handle) noexcept
+      : handle_{ handle } {
+  }
+
+  task(task&& other) noexcept
+      : handle_{ std::exchange(other.handle_, {}) } {
+  }
+
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  task(const task&)            = delete;
+  task& operator=(const task&) = delete;
+
+  ~task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  awaiter operator co_await() && noexcept {
+    return awaiter{ handle_ };
+  }
+};
+
+/**
+ * @brief starts a task without awaiting it; it destroys itself when done
+ * @note an exception escaping the task calls std::terminate(), like one
+ * escaping a std::thread; catch them inside the task
+ * @param t
+ */
+void spawn(task<void> t);
+
+/**
+ * @brief awaitable that resumes once a socket is ready
+ *
+ */
+class readiness {
+  event_loop& loop_;
+  SOCKET      sock_;
+  io_event    event_;
+
+public:
+  readiness(event_loop& loop, SOCKET sock, io_event event) noexcept
+      : loop_{ loop }
+      , sock_{ sock }
+      , event_{ event } {
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    loop_.wait(sock_, event_, [h] { h.resume(); });
+  }
+
+  void await_resume() const noexcept {
+  }
+};
+
+/**
+ * @brief awaitable that continues a coroutine on the thread running a loop
+ *
+ */
+class loop_scheduler {
+  event_loop& loop_;
+
+public:
+  explicit loop_scheduler(event_loop& loop) noexcept
+      : loop_{ loop } {
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    loop_.post([h] { h.resume(); });
+  }
+
+  void await_resume() const noexcept {
+  }
+};
+
+/**
+ * @brief awaitable that resolves a name on a shared resolver pool and
+ * continues on the thread running a loop
+ * @note cached names complete without suspending; a lookup that outlives
+ * the awaiting coroutine is dropped once it finishes
+ */
+class resolution {
+  struct lookup;
+
+  event_loop&             loop_;
+  std::string             domain_;
+  std::string             port_;
+  std::optional<endpoint> result_;
+  // shared with the resolver, which may finish after the frame is gone
+  std::shared_ptr<lookup> lookup_;
+
+public:
+  resolution(event_loop& loop, std::string domain, std::string port);
+  ~resolution();
+
+  resolution(const resolution&)            = delete;
+  resolution& operator=(const resolution&) = delete;
+
+  bool     await_ready();
+  void     await_suspend(std::coroutine_handle<> h);
+  endpoint await_resume();
+};
+
+/**
+ * @brief continues on the loop's thread, e.g. after work on a thread_pool
+ * @note the loop's sockets may only be awaited from its own thread
+ * @param loop
+ * @return loop_scheduler
+ */
+loop_scheduler resume_on(event_loop& loop);
+
+/**
+ * @brief suspends until the socket is readable (or closed)
+ *
+ * @param loop
+ * @param sock
+ * @return readiness
+ */
+readiness readable(event_loop& loop, SOCKET sock);
+/**
+ * @brief suspends until the socket is writable (or closed)
+ *
+ * @param loop
+ * @param sock
+ * @return readiness
+ */
+readiness writable(event_loop& loop, SOCKET sock);
+
+/**
+ * @brief resolves domain and port without blocking the loop
+ * @note the loop has to outlive the lookup
+ * @param loop
+ * @param domain
+ * @param port
+ * @return resolution throws socket_exception if the lookup fails
+ */
+resolution async_resolve(event_loop& loop, std::string domain,
+                         std::string port);
+
+/**
+ * @brief resolves domain and connects the (non-blocking) socket
+ *
+ * @param loop
+ * @param sock
+ * @param domain
+ * @param port
+ * @return task<void> throws socket_exception if no address connects
+ */
+task<void> async_connect(event_loop& loop, tcp_socket& sock,
+                         std::string domain, std::string port);
+/**
+ * @brief performs a client ssl handshake without blocking the loop
+ * @note the socket has to be non-blocking (set_blocking(false)); timeout()
+ * does not apply
+ * @param loop
+ * @param sock
+ * @param ctx
+ * @return task<void> throws ssl_exception if the handshake fails
+ */
+task<void> async_ssl_handshake(event_loop& loop, tcp_socket& sock,
+                               tls_context ctx);
+/**
+ * @brief accepts a connection without blocking the loop
+ * @note the server has to be non-blocking (set_blocking(false)); the
+ * returned socket is non-blocking as well
+ * @param loop
+ * @param server
+ * @return task<tcp_socket>
+ */
+task<tcp_socket> async_accept(event_loop& loop, tcp_server_socket& server);
+/**
+ * @brief reads at most size bytes once some are available
+ * @note secure sockets have to be non-blocking (set_blocking(false))
+ * @param loop
+ * @param sock
+ * @param buffer has to stay valid until the task completes
+ * @param size
+ * @return task<int> bytes read, 0 if the peer closed, -1 on errors
+ */
+task<int> async_read(event_loop& loop, tcp_socket& sock, byte* buffer,
+                     size_t size);
+/**
+ * @brief writes the whole buffer
+ * @note secure sockets have to be non-blocking (set_blocking(false))
+ * @param loop
+ * @param sock
+ * @param buffer has to stay valid until the task completes
+ * @param size
+ * @return task<int> bytes written (size) or -1 on errors
+ */
+task<int> async_write(event_loop& loop, tcp_socket& sock, const byte* buffer,
+                      size_t size);
+/**
+ * @brief writes the whole string
+ *
+ * @param loop
+ * @param sock
+ * @param str
+ * @return task<int> bytes written or -1 on errors
+ */
+task<int> async_write(event_loop& loop, tcp_socket& sock, std::string str);
+/**
+ * @brief reads a string up to a newline
+ * @note the socket has to be non-blocking (set_blocking(false))
+ * @param loop
+ * @param sock
+ * @return task<std::string> line without the newline; throws
+ * socket_exception if the peer closes first
+ */
+task<std::string> async_read_line(event_loop& loop, tcp_socket& sock);
+/**
+ * @brief reads one message
+ * @note the socket has to be non-blocking (set_blocking(false)); the view is
+ * valid until the next read on the socket
+ * @param loop
+ * @param sock
+ * @param f has to stay valid until the task completes
+ * @return task<std::string_view> payload; throws socket_exception if the
+ * peer closes first or the frame is malformed
+ */
+task<std::string_view> async_read_frame(event_loop& loop, tcp_socket& sock,
+                                        const framer& f);
+} // namespace socketio
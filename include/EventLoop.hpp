@@ -0,0 +1,330 @@
+#pragma once
+
+#include "Socket.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace socketio {
+/**
+ * @brief readiness flags reported by the event_loop
+ *
+ */
+enum io_event : unsigned int {
+  READABLE = 1 << 0,
+  WRITABLE = 1 << 1,
+  CLOSED   = 1 << 2
+};
+
+/**
+ * @brief readiness based event loop (epoll on Linux, poll elsewhere)
+ *
+ */
+class event_loop {
+  friend class uring;
+  friend class resolution;
+
+public:
+  /**
+   * @brief called with the io_event flags that are ready
+   *
+   */
+  using callback = std::function<void(unsigned int events)>;
+  using task     = std::function<void()>;
+
+private:
+  struct handler {
+    unsigned int events{ 0 };
+    callback     cb{};
+    // one-shot waiters registered with wait()
+    task         on_readable{};
+    task         on_writable{};
+    unsigned int armed{ 0 };
+    bool         registered{ false };
+  };
+
+  /**
+   * @brief lets other threads post() only while the loop exists
+   *
+   */
+  struct lifetime {
+    std::mutex  mutex;
+    event_loop* loop;
+  };
+
+  std::unordered_map<SOCKET, std::shared_ptr<handler>> handlers_;
+  std::vector<task>                                    tasks_;
+  std::mutex                                           tasks_mutex_;
+  std::atomic<bool>                                    stopped_;
+  std::shared_ptr<lifetime>                            lifetime_;
+
+#if defined(__linux__)
+  int epoll_fd_;
+  int wake_fd_;
+#elif !defined(_WIN32)
+  int wake_pipe_[2];
+#endif
+
+  void wake();
+  void drain_wake();
+  void run_tasks();
+  void dispatch(SOCKET s, unsigned int events);
+
+  static unsigned int wanted(const handler& h);
+  void                arm(SOCKET s, handler& h);
+
+public:
+  event_loop();
+  ~event_loop();
+
+  event_loop(const event_loop&)            = delete;
+  event_loop& operator=(const event_loop&) = delete;
+
+  /**
+   * @brief watches a socket
+   *
+   * @param s socket handle
+   * @param events io_event flags to watch (CLOSED is always reported)
+   * @param cb
+   */
+  void add(SOCKET s, unsigned int events, callback cb);
+  /**
+   * @brief changes the watched io_event flags of a socket
+   *
+   * @param s
+   * @param events
+   */
+  void modify(SOCKET s, unsigned int events);
+  /**
+   * @brief stops watching a socket and drops its waiters
+   * @note safe to call from inside the socket's callback
+   * @param s
+   */
+  void remove(SOCKET s);
+
+  /**
+   * @brief runs t once when the socket becomes READABLE or WRITABLE (or
+   * CLOSED), independent of add()
+   * @note replaces an earlier wait for the same event on that socket
+   * @param s
+   * @param event READABLE or WRITABLE
+   * @param t
+   */
+  void wait(SOCKET s, io_event event, task t);
+
+  /**
+   * @brief queues a task to run on the loop thread
+   * @note thread safe
+   * @param t
+   */
+  void post(task t);
+
+  /**
+   * @brief waits for events once and dispatches them
+   *
+   * @param timeout_ms -1 waits indefinitely
+   * @return int number of dispatched socket events
+   */
+  int run_once(int timeout_ms = -1);
+  /**
+   * @brief dispatches events until stop() is called
+   *
+   */
+  void run();
+  /**
+   * @brief makes run() return
+   * @note thread safe
+   */
+  void stop();
+};
+
+/**
+ * @brief non-blocking tcp server that serves many connections on one
+ * event_loop
+ *
+ */
+class tcp_reactor {
+public:
+  using handler = std::function<void(tcp_socket&)>;
+
+private:
+  event_loop&       loop_;
+  tcp_server_socket server_;
+
+  std::unordered_map<SOCKET, tcp_socket> connections_;
+  // closed during a callback, destroyed once it returns (node handles keep
+  // the socket at its address)
+  std::vector<decltype(connections_)::node_type> closing_;
+  bool                                           dispatching_;
+
+  handler on_accept_;
+  handler on_readable_;
+  handler on_writable_;
+  handler on_closed_;
+
+  void accept_all();
+  void handle(SOCKET s, unsigned int events);
+
+public:
+  /**
+   * @brief listens on port and registers with loop
+   *
+   * @param loop
+   * @param port
+   */
+  tcp_reactor(event_loop& loop, const char* port);
+  /**
+   * @brief serves connections of an already listening server socket
+   *
+   * @param loop
+   * @param server
+   */
+  tcp_reactor(event_loop& loop, tcp_server_socket server);
+  ~tcp_reactor();
+
+  tcp_reactor(const tcp_reactor&)            = delete;
+  tcp_reactor& operator=(const tcp_reactor&) = delete;
+
+  /**
+   * @brief called once for every accepted connection
+   *
+   * @param h
+   */
+  void on_accept(handler h);
+  /**
+   * @brief called when a connection has data (read until it would block)
+   *
+   * @param h
+   */
+  void on_readable(handler h);
+  /**
+   * @brief called when a connection can be written to (see want_write())
+   *
+   * @param h
+   */
+  void on_writable(handler h);
+  /**
+   * @brief called before a connection closed by the peer is destroyed
+   *
+   * @param h
+   */
+  void on_closed(handler h);
+
+  /**
+   * @brief enables or disables on_writable notifications for a connection
+   *
+   * @param sock
+   * @param enable
+   */
+  void want_write(tcp_socket& sock, bool enable);
+  /**
+   * @brief closes and destroys a connection
+   * @note the socket stays valid until the current callback returns
+   * @param sock
+   */
+  void close(tcp_socket& sock);
+
+  /**
+   * @brief number of open connections
+   *
+   * @return size_t
+   */
+  size_t size() const;
+};
+
+/**
+ * @brief tcp server with one SO_REUSEPORT listener, event_loop and thread per
+ * worker; the kernel spreads new connections over the listeners
+ * @note a connection stays on the worker that accepted it, handlers of
+ * different workers run concurrently
+ */
+class tcp_reactor_pool {
+public:
+  using handler = std::function<void(tcp_reactor&, tcp_socket&)>;
+
+private:
+  struct worker {
+    event_loop                   loop;
+    std::unique_ptr<tcp_reactor> reactor;
+    std::thread                  thread;
+  };
+
+  std::vector<std::unique_ptr<worker>> workers_;
+
+public:
+  /**
+   * @brief opens the listeners
+   *
+   * @param address address to bind to, nullptr or "" for all interfaces
+   * @param port
+   * @param threads number of workers, 0 for one per core
+   * @param backlog accept queue length of each listener
+   */
+  tcp_reactor_pool(const char* address, const char* port, size_t threads = 0,
+                   int backlog = SOMAXCONN);
+  /**
+   * @brief stops and joins the workers
+   *
+   */
+  ~tcp_reactor_pool();
+
+  tcp_reactor_pool(const tcp_reactor_pool&)            = delete;
+  tcp_reactor_pool& operator=(const tcp_reactor_pool&) = delete;
+
+  /**
+   * @brief called once for every accepted connection
+   * @note set handlers before start(); they are copied to every worker
+   * @param h
+   */
+  void on_accept(handler h);
+  /**
+   * @brief called when a connection has data (read until it would block)
+   *
+   * @param h
+   */
+  void on_readable(handler h);
+  /**
+   * @brief called when a connection can be written to (see
+   * tcp_reactor::want_write())
+   *
+   * @param h
+   */
+  void on_writable(handler h);
+  /**
+   * @brief called before a connection closed by the peer is destroyed
+   *
+   * @param h
+   */
+  void on_closed(handler h);
+
+  /**
+   * @brief runs every worker's event_loop on its own thread
+   *
+   */
+  void start();
+  /**
+   * @brief stops the event loops and waits for the threads
+   *
+   */
+  void stop();
+
+  /**
+   * @brief number of workers
+   *
+   * @return size_t
+   */
+  size_t size() const;
+  /**
+   * @brief event loop of a worker, e.g. to post() work to it
+   *
+   * @param index
+   * @return event_loop&
+   */
+  event_loop& loop(size_t index);
+};
+} // namespace socketio
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Socket.hpp"
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace socketio {
+/**
+ * @brief splits a byte stream into messages and encodes messages for it
+ * @note used by tcp_socket::read_frame(), try_read_frame() and write_frame();
+ * framers are stateless, one instance can serve many sockets
+ */
+class framer {
+public:
+  /**
+   * @brief largest header any framer writes in front of a payload
+   *
+   */
+  static constexpr size_t header_capacity = 10;
+  /**
+   * @brief default limit for a single payload
+   *
+   */
+  static constexpr size_t default_max_size = 16 * 1024 * 1024;
+
+  virtual ~framer() = default;
+
+  /**
+   * @brief looks for a complete frame at the start of data
+   * @note throws socket_exception on malformed or oversized frames
+   * @param data buffered bytes
+   * @param[out] payload the message, a view into data
+   * @param checked leading bytes of data an earlier call already saw without
+   * finding a complete frame, searches may resume behind them
+   * @return size_t bytes the whole frame takes, 0 if it is not complete yet
+   */
+  virtual size_t decode(std::string_view data, std::string_view& payload,
+                        size_t checked = 0) const = 0;
+  /**
+   * @brief writes the header for a payload of the given size
+   *
+   * @param size payload size
+   * @param header room for header_capacity bytes
+   * @return size_t header length
+   */
+  virtual size_t encode_header(size_t size, byte* header) const = 0;
+  /**
+   * @brief bytes sent behind every payload
+   *
+   * @return std::string_view empty for length prefixes
+   */
+  virtual std::string_view trailer() const;
+
+  /**
+   * @brief turns a payload that was written into a buffer with a reserved
+   * header slot into a frame, without moving the payload
+   * @note the header_capacity bytes in front of payload and trailer().size()
+   * bytes behind it have to be writable
+   * @param payload
+   * @param size
+   * @return std::span<const byte> the encoded frame, ends behind the trailer
+   */
+  std::span<const byte> seal(byte* payload, size_t size) const;
+};
+
+/**
+ * @brief frames prefixed with a fixed size unsigned length
+ *
+ */
+class length_prefix_framer : public framer {
+  size_t width_;
+  bool   big_endian_;
+  size_t max_size_;
+
+public:
+  /**
+   * @brief
+   *
+   * @param width prefix bytes: 1, 2, 4 or 8
+   * @param big_endian network byte order (default) or little endian
+   * @param max_size largest accepted payload
+   */
+  explicit length_prefix_framer(size_t width = 4, bool big_endian = true,
+                                size_t max_size = default_max_size);
+
+  size_t decode(std::string_view data, std::string_view& payload,
+                size_t checked = 0) const override;
+  size_t encode_header(size_t size, byte* header) const override;
+};
+
+/**
+ * @brief frames prefixed with a varint length (LEB128, as in protobuf)
+ *
+ */
+class varint_framer : public framer {
+  size_t max_size_;
+
+public:
+  explicit varint_framer(size_t max_size = default_max_size);
+
+  size_t decode(std::string_view data, std::string_view& payload,
+                size_t checked = 0) const override;
+  size_t encode_header(size_t size, byte* header) const override;
+};
+
+/**
+ * @brief frames terminated by a delimiter
+ * @note payloads must not contain the delimiter
+ */
+class delimiter_framer : public framer {
+  std::string delimiter_;
+  size_t      max_size_;
+
+public:
+  /**
+   * @brief
+   *
+   * @param delimiter not empty
+   * @param max_size largest accepted payload
+   */
+  explicit delimiter_framer(std::string delimiter = "\n",
+                            size_t      max_size  = default_max_size);
+
+  size_t decode(std::string_view data, std::string_view& payload,
+                size_t checked = 0) const override;
+  size_t encode_header(size_t size, byte* header) const override;
+  std::string_view trailer() const override;
+};
+} // namespace socketio
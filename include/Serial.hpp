@@ -1,14 +1,26 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <exception>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
+
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
+// std::min and std::max instead of the windows.h macros
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <windows.h>
+#endif
 
 namespace serialio {
 typedef unsigned char byte;
 
+#ifdef _WIN32
 enum Baud : unsigned int {
   BD_110    = CBR_110,
   BD_300    = CBR_300,
@@ -24,7 +36,10 @@ enum Baud : unsigned int {
   BD_57600  = CBR_57600,
   BD_115200 = CBR_115200,
   BD_128000 = CBR_128000,
-  BD_256000 = CBR_256000
+  BD_230400 = 230400,
+  BD_256000 = CBR_256000,
+  BD_460800 = 460800,
+  BD_921600 = 921600
 };
 
 enum StopBits : unsigned char {
@@ -53,15 +68,81 @@ enum Event : unsigned int {
   CHAR_FLAG     = EV_RXFLAG,
   OUTPUT_EMPTY  = EV_TXEMPTY
 };
+#else
+// same values as the Win32 constants, rates the termios backend can't set
+// make open() throw
+enum Baud : unsigned int {
+  BD_110    = 110,
+  BD_300    = 300,
+  BD_600    = 600,
+  BD_1200   = 1200,
+  BD_2400   = 2400,
+  BD_4800   = 4800,
+  BD_9600   = 9600,
+  BD_14400  = 14400,
+  BD_19200  = 19200,
+  BD_38400  = 38400,
+  BD_56000  = 56000,
+  BD_57600  = 57600,
+  BD_115200 = 115200,
+  BD_128000 = 128000,
+  BD_230400 = 230400,
+  BD_256000 = 256000,
+  BD_460800 = 460800,
+  BD_921600 = 921600
+};
+
+enum StopBits : unsigned char {
+  BITS_1  = 0,
+  BITS_10 = 1,
+  BITS_15 = 2,
+  BITS_20 = 4
+};
+
+enum Parity : unsigned char {
+  NO_PRT    = 0,
+  ODD_PRT   = 1,
+  EVEN_PRT  = 2,
+  MARK_PRT  = 3,
+  SPACE_PRT = 4
+};
+
+enum Event : unsigned int {
+  CHAR_REVEIVED = 0x0001,
+  CHAR_FLAG     = 0x0002,
+  OUTPUT_EMPTY  = 0x0004,
+  CTS_CHANGED   = 0x0008,
+  DSR_CHANGED   = 0x0010,
+  RLSD_CHANGED  = 0x0020,
+  BREAK         = 0x0040,
+  ERR           = 0x0080,
+  RING          = 0x0100
+};
+#endif
 
 class serial_exception : public std::exception {
 private:
   const char* info_;
-  const char* msg_;
+  // owned, messages are often built from temporaries
+  std::string msg_;
 
 public:
+#ifdef _WIN32
   explicit serial_exception(DWORD info) noexcept;
-  explicit serial_exception(const char* msg) noexcept;
+#else
+  /**
+   * @brief
+   *
+   * @param error errno value, getInfo() returns its description
+   */
+  explicit serial_exception(int error) noexcept;
+#endif
+  /**
+   * @brief
+   * @note copies msg, so it may throw std::bad_alloc
+   * @param msg
+   */
+  explicit serial_exception(const char* msg);
   virtual ~serial_exception() noexcept = default;
   virtual const char* what() const noexcept;
 
@@ -83,8 +164,17 @@ public:
     this->name = name;
   }
 
+  /**
+   * @brief COM<num> on Windows, /dev/ttyS<num> elsewhere
+   *
+   * @param num
+   */
   serial_port(int num) {
+#ifdef _WIN32
     this->name = "COM" + std::to_string(num);
+#else
+    this->name = "/dev/ttyS" + std::to_string(num);
+#endif
   }
 
   friend std::ostream& operator<<(std::ostream& out, const serial_port& port) {
@@ -92,14 +182,29 @@ public:
   }
 };
 
+class serial_loop;
+
 /**
  * @brief An object of the Serial class encapsulates a serial-interface and
  * therefor a serial port.
- *
+ * @note on Linux and Mac the port is a termios device (e.g. /dev/ttyUSB0 or
+ * a pseudo terminal), used in raw mode through a non-blocking descriptor
  */
 class serial {
+  friend class serial_loop;
+
 private:
+#ifdef _WIN32
   HANDLE            serialHandle;
+  // reused by every blocking read and write, the handle is overlapped
+  OVERLAPPED        readOverlapped_{};
+  OVERLAPPED        writeOverlapped_{};
+#else
+  int               serialHandle;
+  // what sampleLines() saw last: interrupt counters and modem line levels
+  std::array<int, 6> lineCounts_{};
+  int                modemLines_{ 0 };
+#endif
   const serial_port port_;
   const Baud        baud_;
   const int         byteSize_;
@@ -107,6 +212,64 @@ private:
   const Parity      parity_;
   bool              open_;
 
+  // bytes read ahead by readLine(), positions grow and wrap with the mask
+  std::vector<byte>     ring_;
+  size_t                head_;
+  size_t                tail_;
+  std::string           delimiter_;
+  std::array<bool, 256> keep_;
+
+  // background reader, see startReader()
+  struct reader;
+  std::unique_ptr<reader> reader_;
+
+  /**
+   * @brief reads from the port, bypassing the read-ahead buffer
+   *
+   */
+  unsigned long readSome(byte buffer[], unsigned int bytes);
+  /**
+   * @brief reads whatever the port has (at least one byte unless the read
+   * timeout passes) with one call
+   * @note throws serial_exception if the port went away
+   * @return unsigned long bytes read
+   */
+  unsigned long readChunk(byte buffer[], size_t bytes);
+  /**
+   * @brief reads a chunk from the port or the reader thread into the
+   * read-ahead buffer
+   *
+   * @return unsigned long bytes read
+   */
+  unsigned long fill();
+  /**
+   * @brief free contiguous space behind the buffered bytes, grows the buffer
+   * if it is full
+   *
+   * @param[out] space
+   * @return byte* start of the space
+   */
+  byte* ringSpace(size_t& space);
+  /**
+   * @brief offset of the first delimiter at or after from
+   *
+   * @return size_t std::string::npos if there is none
+   */
+  size_t findDelimiter(size_t from) const;
+#ifndef _WIN32
+  /**
+   * @brief how often modem lines and breaks are sampled, termios can not
+   * wait for them together with data
+   */
+  static constexpr int lineSampleInterval = 10;
+  /**
+   * @brief modem line changes, breaks and line errors since the last call
+   * @note pseudo terminals have none
+   * @return unsigned int Event flags
+   */
+  unsigned int sampleLines();
+#endif
+
 public:
   /**
    * @brief Constructor
@@ -166,11 +329,14 @@ public:
   bool isCTS() const;
 
   /**
-   * @brief Blocking. \n waits for event to occur. \n Experimental
-   *
-   * @param event event to wait for
+   * @brief Blocking. \n waits for one of the events to occur
+   * @note WaitCommEvent() on Windows; elsewhere modem lines and breaks are
+   * sampled (with TIOCGICOUNT on Linux), CHAR_FLAG is not supported. Do not
+   * use it on a port a serial_loop watches.
+   * @param events Event flags to wait for
+   * @return unsigned int Event flags that occurred
    */
-  [[deprecated("Not yet implemented")]] void waitFor(Event event) const;
+  unsigned int waitFor(unsigned int events);
 
   /**
    * @brief reads bytes into buffer
@@ -189,12 +355,89 @@ public:
   byte read();
 
   /**
-   * @brief Blocking. read until first occurrence of \\n
-   *
-   * @return string read string without last \\n
+   * @brief Blocking. read until first occurrence of the delimiter (\\n)
+   * @note reads everything the port has per call and keeps what follows the
+   * line for the next read; bytes rejected by the line filter are dropped
+   * @return string read string without the delimiter
    */
   std::string readLine();
 
+  /**
+   * @brief sets what readLine() reads up to
+   *
+   * @param delimiter not empty, \\n by default
+   */
+  void setDelimiter(const std::string& delimiter);
+
+  /**
+   * @brief chooses the bytes readLine() keeps
+   * @note by default only printable ASCII (32 - 126) is kept
+   * @param keep asked once per byte value, empty keeps every byte
+   */
+  void setLineFilter(const std::function<bool(byte)>& keep);
+
+  /**
+   * @brief starts a thread that keeps draining the port into a lock-free
+   * ring buffer, so bursts do not overflow the driver's buffer
+   * @note while it runs, all reads take from the ring; when it is full, new
+   * bytes are dropped and counted. Reads must come from one thread.
+   * @param capacity ring size in bytes, rounded up to a power of two
+   */
+  void startReader(size_t capacity = 64 * 1024);
+
+  /**
+   * @brief stops the reader thread, bytes it buffered stay readable
+   *
+   */
+  void stopReader();
+
+  /**
+   * @brief is the reader thread started
+   */
+  bool isReaderRunning() const;
+
+  /**
+   * @brief Non-blocking. takes what the reader thread buffered
+   * @note throws serial_exception if the reader is not running or the port
+   * went away
+   * @param[out] buffer buffer to write into
+   * @param bytes maximum number of bytes to read
+   * @param[out] received when the reader got the first byte, may be nullptr
+   * @return unsigned long number of bytes read, 0 if nothing is buffered
+   */
+  unsigned long tryRead(
+      byte buffer[], unsigned int bytes,
+      std::chrono::steady_clock::time_point* received = nullptr);
+
+  /**
+   * @brief waits up to timeoutMs for the reader thread to buffer data and
+   * takes what is there
+   * @note throws serial_exception if the reader is not running or the port
+   * went away
+   * @param[out] buffer buffer to write into
+   * @param bytes maximum number of bytes to read
+   * @param timeoutMs
+   * @param[out] received when the reader got the first byte, may be nullptr
+   * @return unsigned long number of bytes read, 0 on timeout
+   */
+  unsigned long read(byte buffer[], unsigned int bytes, int timeoutMs,
+                     std::chrono::steady_clock::time_point* received
+                     = nullptr);
+
+  /**
+   * @brief bytes the reader thread dropped because its ring was full
+   *
+   * @return unsigned long long
+   */
+  unsigned long long droppedBytes() const;
+
+  /**
+   * @brief times the reader thread's ring ran full
+   *
+   * @return unsigned long long
+   */
+  unsigned long long overflows() const;
+
   /**
    * @brief write bytes from buffer
    *
@@ -226,7 +469,8 @@ public:
   void writeLine(const std::string& s);
 
   /**
-   * @brief returns bytes in input buffer. (clears comm errors)
+   * @brief returns bytes in input buffer, including the ones readLine() read
+   * ahead. (clears comm errors)
    *
    * @return unsigned int bytes available
    */
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "Serial.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace serialio {
+/**
+ * @brief services reads, writes and modem line events of many serial ports
+ * from one thread
+ * @note overlapped I/O on a completion port with WaitCommEvent() on Windows,
+ * epoll (poll outside Linux) on the non-blocking descriptors elsewhere.
+ * Handlers run on the thread calling run(); asyncRead(), asyncWrite(),
+ * watch() and cancel() belong on that thread too, other threads post() them.
+ */
+class serial_loop {
+public:
+  /**
+   * @brief called with the bytes read, size 0 if the port failed or went
+   * away
+   * @note data is only valid during the call
+   */
+  using read_handler
+      = std::function<void(const byte* data, unsigned long size)>;
+  /**
+   * @brief called once all bytes of a write are sent, false if the port
+   * failed
+   */
+  using write_handler = std::function<void(bool ok)>;
+  /**
+   * @brief called with the Event flags that occurred
+   *
+   */
+  using event_handler = std::function<void(unsigned int events)>;
+  using task          = std::function<void()>;
+
+private:
+  struct channel {
+    serial*           port;
+    std::vector<byte> in;
+    read_handler      onRead;
+    // queued by asyncWrite() and handed to the system
+    std::vector<byte> out;
+    std::vector<byte> flight;
+    size_t            flightSent;
+    uint64_t          queued;
+    uint64_t          sent;
+    // handlers with the queued position their bytes end at
+    std::deque<std::pair<uint64_t, write_handler>> onWritten;
+    unsigned int                                   watched;
+    event_handler                                  onEvent;
+#ifdef _WIN32
+    // an OVERLAPPED that knows its channel, completions only carry these
+    struct operation : OVERLAPPED {
+      channel* owner{ nullptr };
+      bool     pending{ false };
+      bool     done{ false };
+      bool     ok{ false };
+      DWORD    bytes{ 0 };
+    };
+
+    HANDLE    handle;
+    operation readOp;
+    operation writeOp;
+    operation waitOp;
+    DWORD     occurred;
+    DWORD     commMask;
+    // bytes may wait in the driver that no EV_RXCHAR announces any more
+    bool      checkQueue;
+    bool      failed;
+
+    bool inflight() const;
+#else
+    short revents;
+#ifdef __linux__
+    short armed;
+    bool  registered;
+#endif
+#endif
+
+    explicit channel(serial& port);
+  };
+
+  std::unordered_map<serial*, std::shared_ptr<channel>> channels_;
+  std::vector<task>                                     tasks_;
+  std::mutex                                            tasksMutex_;
+  std::atomic<bool>                                     stopped_;
+
+#ifdef _WIN32
+  HANDLE completionPort_;
+  // cancelled with transfers in flight, kept until the system is done
+  std::vector<std::shared_ptr<channel>> detached_;
+#else
+  int wakePipe_[2];
+#ifdef __linux__
+  int epollFd_;
+#endif
+#endif
+
+  channel& attach(serial& port);
+  bool     attached(const std::shared_ptr<channel>& ch) const;
+  void     wake();
+  void     drainWake();
+  void     runTasks();
+
+  /**
+   * @brief hands the bytes to the pending read handler
+   *
+   */
+  void completeRead(channel& ch, unsigned long size);
+  /**
+   * @brief calls the write handlers whose bytes are sent, or all of them if
+   * the port failed
+   * @return bool true if a handler was due
+   */
+  bool completeWrites(channel& ch, bool failed);
+  /**
+   * @brief moves queued bytes in flight once the previous ones are sent
+   *
+   * @return bool false if nothing is left to send
+   */
+  bool nextFlight(channel& ch);
+#ifdef _WIN32
+  /**
+   * @brief starts the transfers and the event wait the channel needs
+   *
+   * @return bool true if something can be dispatched without waiting
+   */
+  bool prepare(channel& ch);
+  /**
+   * @brief calls the handlers of finished transfers and events
+   *
+   * @return bool true if a handler ran
+   */
+  bool dispatch(const std::shared_ptr<channel>& ch);
+#else
+#ifdef __linux__
+  void arm(channel& ch, short events);
+#endif
+  /**
+   * @brief reads and writes what the port is ready for
+   *
+   * @return bool true if a handler ran
+   */
+  bool dispatch(const std::shared_ptr<channel>& ch, bool readable,
+                bool writable);
+  /**
+   * @brief samples the modem lines and calls the event handler
+   *
+   * @return bool true if it ran
+   */
+  bool notify(const std::shared_ptr<channel>& ch);
+#endif
+
+public:
+  serial_loop();
+  ~serial_loop();
+
+  serial_loop(const serial_loop&)            = delete;
+  serial_loop& operator=(const serial_loop&) = delete;
+
+  /**
+   * @brief calls h once with the next bytes that arrive (all that are
+   * there, at least one)
+   * @note the port has to be open and must not run a reader thread; cancel()
+   * it before closing it. One read per port can be pending.
+   * @param port
+   * @param h
+   */
+  void asyncRead(serial& port, read_handler h);
+
+  /**
+   * @brief queues bytes for the port, writes keep their order
+   * @note the bytes are copied, the buffer may go away right after the call
+   * @param port
+   * @param[in] buffer
+   * @param bytes
+   * @param h may be empty
+   */
+  void asyncWrite(serial& port, const byte buffer[], unsigned int bytes,
+                  write_handler h = {});
+
+  /**
+   * @brief queues a string for the port
+   *
+   * @param port
+   * @param s
+   * @param h may be empty
+   */
+  void asyncWrite(serial& port, const std::string& s, write_handler h = {});
+
+  /**
+   * @brief calls h whenever one of the events occurs on the port
+   * @note CTS_CHANGED, DSR_CHANGED, RLSD_CHANGED, RING, BREAK and ERR; outside
+   * Windows the lines are sampled every few milliseconds (with the interrupt
+   * counters on Linux, pseudo terminals have none)
+   * @param port
+   * @param events Event flags, 0 stops watching
+   * @param h
+   */
+  void watch(serial& port, unsigned int events, event_handler h);
+
+  /**
+   * @brief aborts pending reads and writes of the port and detaches it,
+   * their handlers (and the event handler) are dropped
+   * @note safe to call from inside the port's handlers
+   * @param port
+   */
+  void cancel(serial& port);
+
+  /**
+   * @brief queues a task to run on the loop thread
+   * @note thread safe
+   * @param t
+   */
+  void post(task t);
+
+  /**
+   * @brief waits for transfers once and completes them
+   *
+   * @param timeoutMs -1 waits indefinitely
+   * @return int number of ports whose handlers ran
+   */
+  int runOnce(int timeoutMs = -1);
+
+  /**
+   * @brief completes transfers until stop() is called
+   *
+   */
+  void run();
+
+  /**
+   * @brief makes run() return
+   * @note thread safe
+   */
+  void stop();
+
+  /**
+   * @brief number of attached ports
+   *
+   * @return size_t
+   */
+  size_t size() const;
+};
+} // namespace serialio
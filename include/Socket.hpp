@@ -1,14 +1,19 @@
 #pragma once
 
 #ifdef _WIN32 // Windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <ws2tcpip.h>
 #include <winsock2.h>
 #define MSG_NOSIGNAL 0
+#define MSG_DONTWAIT 0
 #else // Linux + Mac
 
 #include <arpa/inet.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <string.h>
@@ -36,9 +41,21 @@ typedef sockaddr_in SOCKADDR_IN;
 #include <openssl/types.h>
 #endif
 
+#include "BufferPool.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <exception>
+#include <functional>
+#include <future>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <string.h>
 
@@ -80,28 +97,354 @@ public:
 };
 
 /**
- * @brief socket endpoint
+ * @brief read-only memory region for scatter/gather writes
  *
  */
+struct const_buffer {
+  const byte* data;
+  size_t      size;
+};
+
+/**
+ * @brief writable memory region for scatter/gather reads
+ *
+ */
+struct mutable_buffer {
+  byte*  data;
+  size_t size;
+};
+
+/**
+ * @brief error code of the last failed socket call (errno/WSAGetLastError)
+ *
+ * @return int
+ */
+int last_socket_error();
+
+/**
+ * @brief did the last failed socket call fail because it would have blocked
+ *
+ * @return true
+ * @return false
+ */
+bool would_block();
+
+/**
+ * @brief socket endpoint
+ * @note resolved addresses are cached for a while (see set_cache_ttl) and
+ * shared between endpoints of the same domain and port
+ */
 class endpoint {
   friend class base_socket;
+  friend class tcp_socket;
   std::string domain;
   short       port;
 
-  addrinfo* addr_info;
+  std::shared_ptr<addrinfo> addr_info;
 
 public:
   endpoint();
+  /**
+   * @brief resolves domain and port, blocks unless the result is cached
+   * @note concurrent lookups of the same domain and port share one
+   * getaddrinfo call
+   * @param domain
+   * @param port
+   */
   endpoint(const char* domain, const char* port);
   endpoint(const std::string& domain, const char* port);
 
+  /**
+   * @brief takes over the resolved addresses of other
+   * @note other is left empty
+   * @param other
+   */
+  endpoint(endpoint&& other) noexcept;
+  endpoint& operator=(endpoint&& other) noexcept;
+
+  endpoint(const endpoint&)            = delete;
+  endpoint& operator=(const endpoint&) = delete;
+
   ~endpoint();
 
   operator addrinfo*();
 
+  /**
+   * @brief resolves domain and port on a worker thread
+   *
+   * @param domain
+   * @param port
+   * @return std::future<endpoint> throws socket_exception on get() if the
+   * lookup failed
+   */
+  static std::future<endpoint> resolve_async(std::string domain,
+                                             std::string port);
+  /**
+   * @brief endpoint from the cache, without resolving
+   *
+   * @param domain
+   * @param port
+   * @return std::optional<endpoint> empty if not cached or expired
+   */
+  static std::optional<endpoint> cached(const std::string& domain,
+                                        const std::string& port);
+  /**
+   * @brief how long resolved addresses are reused
+   * @note defaults to 30 seconds, 0 disables caching; failed lookups are
+   * never cached
+   * @param ttl
+   */
+  static void set_cache_ttl(std::chrono::milliseconds ttl);
+  /**
+   * @brief forgets all cached addresses
+   *
+   */
+  static void clear_cache();
+
   // friend std::ostream& operator<<(std::ostream& out, const endpoint& ep);
 };
 
+/**
+ * @brief contiguous byte buffer with a read and a write cursor
+ * @note readable bytes are [data(), data() + size()); prepare() may move them
+ */
+class byte_buffer {
+  std::pmr::memory_resource* resource_;
+  byte*                      data_;
+  size_t                     capacity_;
+  size_t                     begin_;
+  size_t                     end_;
+
+public:
+  /**
+   * @brief
+   *
+   * @param capacity
+   * @param resource where the storage comes from, nullptr for
+   * buffer_pool::global()
+   */
+  explicit byte_buffer(size_t                     capacity = 0,
+                       std::pmr::memory_resource* resource = nullptr);
+  ~byte_buffer();
+
+  byte_buffer(byte_buffer&& other) noexcept;
+  byte_buffer& operator=(byte_buffer&& other) noexcept;
+
+  byte_buffer(const byte_buffer&)            = delete;
+  byte_buffer& operator=(const byte_buffer&) = delete;
+
+  /**
+   * @brief start of the readable bytes
+   *
+   * @return byte*
+   */
+  byte*       data();
+  const byte* data() const;
+  /**
+   * @brief number of readable bytes
+   *
+   * @return size_t
+   */
+  size_t size() const;
+  bool   empty() const;
+
+  /**
+   * @brief readable bytes as string_view
+   *
+   * @return std::string_view
+   */
+  std::string_view view() const;
+
+  /**
+   * @brief drops bytes from the front of the readable region
+   *
+   * @param size
+   */
+  void consume(size_t size);
+  /**
+   * @brief makes room for at least size bytes behind the readable region
+   * @note compacts or grows the buffer, invalidating earlier pointers
+   * @param size
+   * @return byte* start of the writable region
+   */
+  byte* prepare(size_t size);
+  /**
+   * @brief marks size bytes of the prepared region as readable
+   *
+   * @param size
+   */
+  void commit(size_t size);
+  /**
+   * @brief drops all readable bytes
+   *
+   */
+  void clear();
+  /**
+   * @brief drops all readable bytes and hands the storage back
+   *
+   */
+  void reset();
+};
+
+/**
+ * @brief side of the handshake a tls_context is made for
+ *
+ */
+enum tls_role : unsigned int { TLS_CLIENT = 0, TLS_SERVER = 1 };
+
+/**
+ * @brief tls settings shared by many secure sockets
+ * @note copies share the same OpenSSL context and session cache; sockets keep
+ * the context alive while they use it
+ * @note by default the peer certificate is not verified (same as a plain
+ * ssl_handshake()), see set_verify()
+ * @note configure a context before its first handshake; afterwards it can be
+ * used by handshakes on many threads at once
+ */
+class tls_context {
+  friend class tcp_socket;
+
+  struct state;
+  std::shared_ptr<state> state_;
+
+  explicit tls_context(std::shared_ptr<state> state);
+
+public:
+  /**
+   * @brief picks the context for the host name a client asked for
+   * @note ctx starts as the context the handler is set on; assign another
+   * (server) context to present its certificate and ALPN list. Contexts
+   * handed out have to outlive the handler.
+   * @return false to abort the handshake
+   */
+  using sni_handler
+      = std::function<bool(const std::string& host, tls_context& ctx)>;
+
+  /**
+   * @brief creates a context with an enabled session cache
+   * @note server contexts need use_certificate() before their first
+   * handshake
+   * @param role
+   */
+  explicit tls_context(tls_role role = TLS_CLIENT);
+
+  /**
+   * @brief side of the handshake this context is made for
+   *
+   * @return tls_role
+   */
+  tls_role role() const;
+
+  /**
+   * @brief verify the peer certificate and host name during handshakes
+   * @note server contexts require a client certificate
+   * @param verify_peer
+   */
+  void set_verify(bool verify_peer);
+  /**
+   * @brief trusts the system certificate store
+   *
+   */
+  void set_default_verify_paths();
+  /**
+   * @brief trusts the certificates in ca_file and/or ca_path
+   *
+   * @param ca_file PEM file, may be empty
+   * @param ca_path hashed certificate directory, may be empty
+   */
+  void load_verify_locations(const std::string& ca_file,
+                             const std::string& ca_path = "");
+  /**
+   * @brief certificate (chain) and private key presented to the peer
+   *
+   * @param cert_file PEM file
+   * @param key_file PEM file
+   */
+  void use_certificate(const std::string& cert_file,
+                       const std::string& key_file);
+  /**
+   * @brief cipher list for TLS 1.2 and below (OpenSSL syntax)
+   *
+   * @param ciphers
+   */
+  void set_ciphers(const std::string& ciphers);
+  /**
+   * @brief cipher suites for TLS 1.3 (OpenSSL syntax)
+   *
+   * @param ciphersuites
+   */
+  void set_ciphersuites(const std::string& ciphersuites);
+
+  /**
+   * @brief application protocols (e.g. "h2", "http/1.1") in order of
+   * preference
+   * @note clients offer them, servers pick their first one the client offers
+   * and continue without ALPN if there is none
+   * @param protocols
+   */
+  void set_alpn(const std::vector<std::string>& protocols);
+  /**
+   * @brief lets a server context choose the certificate by host name (SNI)
+   * @note the handler is also called with an empty host if the client sent
+   * none
+   * @param handler
+   */
+  void set_sni_handler(sni_handler handler);
+
+  /**
+   * @brief lets the Linux kernel encrypt and decrypt records once a
+   * handshake is done (kTLS)
+   * @note needs the tls kernel module and a cipher it supports (AES-GCM,
+   * ChaCha20-Poly1305); otherwise sockets silently stay in user space, see
+   * tcp_socket::ktls_send()
+   * @param enable
+   * @return true if this OpenSSL build supports kTLS
+   */
+  bool set_ktls(bool enable);
+
+  /**
+   * @brief keep sessions (TLS 1.3 tickets) per host and port to resume later
+   * handshakes
+   * @note enabled by default; server contexts resume sessions of their
+   * clients instead
+   * @param enable
+   */
+  void set_session_cache(bool enable);
+  /**
+   * @brief forgets all cached sessions
+   *
+   */
+  void clear_sessions();
+  /**
+   * @brief number of hosts (server: clients) with a cached session
+   *
+   * @return size_t
+   */
+  size_t cached_sessions() const;
+
+#ifdef USE_OPENSSL
+  /**
+   * @brief underlying OpenSSL context for settings without a wrapper
+   *
+   * @return SSL_CTX*
+   */
+  SSL_CTX* native_handle() const;
+#endif
+};
+
+/**
+ * @brief progress of a handshake driven with start_ssl_handshake() and
+ * continue_ssl_handshake()
+ *
+ */
+enum handshake_state : unsigned int {
+  HANDSHAKE_DONE       = 0,
+  HANDSHAKE_WANT_READ  = 1,
+  HANDSHAKE_WANT_WRITE = 2
+};
+
+class framer;
+
 /**
  * @brief base class for sockets
  *
@@ -111,9 +454,30 @@ class base_socket {
 
 protected:
   SOCKET sock;
+  bool   blocking_;
 
   base_socket();
+  base_socket(base_socket&& other) noexcept;
+  base_socket& operator=(base_socket&& other) noexcept;
   virtual ~base_socket() = default;
+
+  base_socket(const base_socket&)            = delete;
+  base_socket& operator=(const base_socket&) = delete;
+
+public:
+  /**
+   * @brief the underlying socket handle
+   *
+   * @return SOCKET
+   */
+  SOCKET native_handle() const;
+
+  /**
+   * @brief switches the socket between blocking and non-blocking mode
+   * @note in non-blocking mode reads and writes return -1 instead of waiting
+   * @param blocking
+   */
+  void set_blocking(bool blocking);
 };
 
 /**
@@ -122,13 +486,49 @@ protected:
  */
 class tcp_socket : base_socket {
   friend class tcp_server_socket;
+  friend class uring;
 
 private:
-  endpoint ept_;
+  /**
+   * @brief MSG_ZEROCOPY send whose buffer the kernel may still read
+   *
+   */
+  struct zerocopy_send {
+    uint32_t              first;
+    uint32_t              last;
+    uint32_t              remaining;
+    std::function<void()> release;
+  };
+
+  endpoint    ept_;
+  byte_buffer rbuf_;
+  // leading bytes of rbuf_ a framer searched without finding a frame
+  size_t      frame_checked_;
+  int         timeout_;
+  int         connect_timeout_;
+  int         attempt_timeout_;
+
+  size_t                    zerocopy_threshold_;
+  uint32_t                  zerocopy_seq_;
+  std::deque<zerocopy_send> zerocopy_pending_;
+
+  static size_t reap_zerocopy(SOCKET sock, std::deque<zerocopy_send>& pending,
+                              int timeout_ms);
+  static void   defer_zerocopy(SOCKET sock, std::deque<zerocopy_send> pending);
+
+  byte_buffer                           wbuf_;
+  size_t                                write_threshold_;
+  int                                   flush_delay_;
+  std::chrono::steady_clock::time_point buffered_since_;
 
 #ifdef USE_OPENSSL
-  SSL*     ssl;
-  SSL_CTX* ssl_ctx;
+  struct ssl_deleter {
+    void operator()(SSL* ssl) const noexcept;
+  };
+
+  std::unique_ptr<SSL, ssl_deleter> ssl;
+  // keeps the SSL_CTX of ssl alive
+  std::shared_ptr<tls_context::state> ssl_ctx;
 #endif
 
   tcp_socket(SOCKET s);
@@ -158,6 +558,22 @@ private:
    * @return int
    */
   int uread(byte* buffer, size_t size, int flags = 0);
+  /**
+   * @brief unsafe gather write(no ssl)
+   *
+   * @param buffers
+   * @param flags
+   * @return int
+   */
+  int uwrite(std::span<const const_buffer> buffers, int flags = 0);
+  /**
+   * @brief unsafe scatter read(no ssl)
+   *
+   * @param buffers
+   * @param flags
+   * @return int
+   */
+  int uread(std::span<const mutable_buffer> buffers, int flags = 0);
 
   /**
    * @brief safe write(ssl)
@@ -175,11 +591,77 @@ private:
    * @return int
    */
   int sread(byte* buffer, size_t size);
+  /**
+   * @brief safe gather write(ssl), coalescing small buffers into one record
+   *
+   * @param buffers
+   * @return int
+   */
+  int swrite(std::span<const const_buffer> buffers);
+  /**
+   * @brief safe scatter read(ssl)
+   *
+   * @param buffers
+   * @return int
+   */
+  int sread(std::span<const mutable_buffer> buffers);
+
+  /**
+   * @brief reads one chunk from the socket into the receive buffer
+   *
+   * @return int bytes read
+   */
+  int fill();
+
+  /**
+   * @brief writes without going through the output buffer
+   *
+   * @param buffers
+   * @param flags
+   * @return int bytes written
+   */
+  int write_direct(std::span<const const_buffer> buffers, int flags);
+  /**
+   * @brief sends buffered output before waiting for a reply
+   *
+   */
+  void flush_before_read();
 
 public:
+  /**
+   * @brief bytes requested from the socket per receive buffer refill
+   *
+   */
+  static constexpr size_t read_chunk_size = 16 * 1024;
+  /**
+   * @brief buffers handed to the kernel per scatter/gather call
+   *
+   */
+  static constexpr size_t max_buffers = 64;
+
+  using base_socket::native_handle;
+  using base_socket::set_blocking;
+
   tcp_socket();
   ~tcp_socket();
 
+  /**
+   * @brief takes over the connection, buffered data and tls state of other
+   * @note other is left closed
+   * @param other
+   */
+  tcp_socket(tcp_socket&& other) noexcept;
+  /**
+   * @brief closes this socket and takes over other
+   *
+   * @param other
+   * @return tcp_socket&
+   */
+  tcp_socket& operator=(tcp_socket&& other) noexcept;
+
+  tcp_socket(const tcp_socket&)            = delete;
+  tcp_socket& operator=(const tcp_socket&) = delete;
+
   /**
    * @brief is the socket valid
    *
@@ -205,7 +687,9 @@ public:
 
   /**
    * @brief connects to endpoint
-   *
+   * @note races the resolved addresses (RFC 8305 Happy Eyeballs): address
+   * families are interleaved and a new attempt starts whenever the earlier
+   * ones did not connect within 250 ms; the first connected socket wins
    * @param ept
    */
   void connect(endpoint ept);
@@ -217,6 +701,20 @@ public:
    */
   void connect(const char* domain, const char* port);
 
+  /**
+   * @brief opens a non-blocking socket and starts connecting to addr
+   * @note if it returns false, wait until the socket is writable and call
+   * finish_connect()
+   * @param addr
+   * @return true if connected immediately
+   */
+  bool start_connect(const addrinfo* addr);
+  /**
+   * @brief completes a connect started with start_connect()
+   * @note closes the socket and throws socket_exception if it failed
+   */
+  void finish_connect();
+
   /**
    * @brief closes the connection
    *
@@ -225,9 +723,96 @@ public:
 
   /**
    * @brief performs ssl handshake
-   *
+   * @note uses a client context shared by all sockets of the process
    */
   void ssl_handshake();
+  /**
+   * @brief performs ssl handshake with the settings of ctx
+   * @note the socket takes the role of ctx; a TLS_SERVER context answers a
+   * client on an accepted socket
+   * @note resumes a cached session for the connected host if there is one
+   * @note waits for the socket between steps, at most timeout() ms in total
+   * @param ctx
+   */
+  void ssl_handshake(const tls_context& ctx);
+  /**
+   * @brief starts a handshake without waiting for the socket
+   * @note meant for non-blocking sockets driven by an event loop; call
+   * continue_ssl_handshake() once the socket is ready as requested
+   * @param ctx
+   * @return handshake_state
+   */
+  handshake_state start_ssl_handshake(const tls_context& ctx);
+  /**
+   * @brief advances a started handshake
+   * @note throws ssl_exception (and drops the tls state) if the handshake
+   * fails
+   * @return handshake_state
+   */
+  handshake_state continue_ssl_handshake();
+
+  /**
+   * @brief limits how long blocking handshakes, reads and writes wait for
+   * the socket
+   * @note a timed out plain read/write returns -1 (would_block()), a secure
+   * one throws ssl_exception; ssl_handshake() applies it to the whole
+   * handshake
+   * @param timeout_ms -1 waits forever (default)
+   */
+  void set_timeout(int timeout_ms);
+  /**
+   * @brief see set_timeout()
+   *
+   * @return int
+   */
+  int timeout() const;
+  /**
+   * @brief limits how long connect() may take
+   * @note connect() throws socket_exception once timeout_ms passed
+   * @param timeout_ms for the whole connect, -1 waits forever (default)
+   * @param attempt_timeout_ms for a single address, -1 for no extra limit
+   */
+  void set_connect_timeout(int timeout_ms, int attempt_timeout_ms = -1);
+  /**
+   * @brief see set_connect_timeout()
+   *
+   * @return int
+   */
+  int connect_timeout() const;
+  /**
+   * @brief did the last handshake resume a cached session
+   *
+   * @return true
+   * @return false
+   */
+  bool session_reused() const;
+  /**
+   * @brief is record encryption of sent data done by the kernel (kTLS)
+   * @note writes then skip OpenSSL's record buffer and send_file() uses
+   * sendfile
+   * @return true
+   * @return false
+   */
+  bool ktls_send() const;
+  /**
+   * @brief is record decryption of received data done by the kernel (kTLS)
+   *
+   * @return true
+   * @return false
+   */
+  bool ktls_recv() const;
+  /**
+   * @brief protocol agreed on with ALPN
+   *
+   * @return std::string empty if none was negotiated
+   */
+  std::string alpn_protocol() const;
+  /**
+   * @brief host name the client asked for (SNI)
+   *
+   * @return std::string empty if none was sent
+   */
+  std::string server_name() const;
 
   /**
    * @brief writes byte array
@@ -259,16 +844,146 @@ public:
    * @return int bytes written
    */
   int writeLine(const std::string& str);
+  /**
+   * @brief writes several buffers with one call (sendmsg/WSASend)
+   * @note with ssl, buffers are coalesced into as few records as possible;
+   * at most max_buffers buffers are sent per call
+   * @param buffers
+   * @param flags
+   * @return int bytes written
+   */
+  int write(std::span<const const_buffer> buffers, int flags = 0);
+
+  /**
+   * @brief collects small writes in an output buffer and sends them together
+   * @note the buffer is sent once it holds threshold bytes, on flush(), before
+   * reads, on close() and by the first write after flush_delay_ms; larger
+   * writes bypass it. Enabling it sets TCP_NODELAY (also on sockets
+   * connected or accepted later), as flushes carry complete messages that
+   * should not wait for Nagle's algorithm.
+   * @param threshold 0 disables buffering (default) after flushing
+   * @param flush_delay_ms longest time data may stay buffered, -1 for none
+   */
+  void set_write_buffer(size_t threshold, int flush_delay_ms = -1);
+  /**
+   * @brief sends the buffered output
+   * @note non-blocking sockets keep what they could not send buffered
+   * @return int bytes written, -1 on errors
+   */
+  int flush();
+  /**
+   * @brief bytes waiting in the output buffer
+   * @note also holds TLS writes a non-blocking socket has to retry, they
+   * count as written and go out with the next write, flush() or read
+   * @return size_t
+   */
+  size_t buffered_output() const;
+  /**
+   * @brief bytes already received (and decrypted) that no read returned yet
+   *
+   * @return size_t
+   */
+  size_t buffered_input() const;
+  /**
+   * @brief time until the buffered output is due, for event loop timeouts
+   *
+   * @return int milliseconds, 0 if overdue, -1 if nothing is due
+   */
+  int next_flush() const;
+  /**
+   * @brief disables Nagle's algorithm (TCP_NODELAY)
+   *
+   * @param nodelay
+   */
+  void set_nodelay(bool nodelay);
+  /**
+   * @brief holds back partial packets until uncorked (TCP_CORK on Linux,
+   * TCP_NOPUSH on BSD and macOS)
+   * @note uncorking sends what is pending right away
+   * @param cork
+   * @return true if supported
+   */
+  bool set_cork(bool cork);
+
+  /**
+   * @brief sends length bytes of an open file starting at offset
+   * @note uses sendfile on Linux (SSL_sendfile if kernel TLS is active) and
+   * falls back to chunked reads and writes elsewhere; stops early at the end
+   * of the file or if a non-blocking socket would block
+   * @param fd file descriptor opened for reading
+   * @param offset
+   * @param length
+   * @return int64_t bytes sent, -1 if the socket failed before sending any
+   */
+  int64_t send_file(int fd, int64_t offset, size_t length);
+  /**
+   * @brief opens a file and sends it (see send_file(int, int64_t, size_t))
+   *
+   * @param path
+   * @param offset
+   * @param length defaults to the rest of the file
+   * @return int64_t bytes sent, -1 if the socket failed before sending any
+   */
+  int64_t send_file(const std::string& path, int64_t offset = 0,
+                    size_t length = SIZE_MAX);
+
+  /**
+   * @brief enables MSG_ZEROCOPY sends for write_zerocopy() (Linux 4.14+)
+   * @note page pinning and completion handling only pay off for large
+   * buffers, smaller ones are copied as usual
+   * @param enable
+   * @param threshold smallest buffer sent without copying
+   * @return true if zero-copy sends are available
+   */
+  bool set_zerocopy(bool enable, size_t threshold = 16 * 1024);
+  /**
+   * @brief sends the whole buffer without copying it into the kernel
+   * @note the buffer must not be modified or freed until release is called,
+   * which happens from poll_zerocopy() (or right away if the buffer was
+   * copied); plain sockets only, secure sockets copy
+   * @note close() doesn't wait for outstanding completions, the socket stays
+   * open in the background until they arrive and release is then called
+   * from a background thread
+   * @param buffer
+   * @param size
+   * @param release called once the kernel is done with buffer
+   * @return int bytes sent or -1
+   */
+  int write_zerocopy(const byte* buffer, size_t size,
+                     std::function<void()> release);
+  /**
+   * @brief reads zero-copy completions from the error queue and releases
+   * the finished buffers
+   *
+   * @param timeout_ms how long to wait for a completion, 0 doesn't wait
+   * @return size_t number of released buffers
+   */
+  size_t poll_zerocopy(int timeout_ms = 0);
+  /**
+   * @brief number of zero-copy buffers the kernel has not released yet
+   *
+   * @return size_t
+   */
+  size_t zerocopy_pending() const;
 
   /**
    * @brief reads byte array
    * @note reads save if ssl_handshake has been performed else reads unsafe
+   * @note buffered bytes left over from read()/readLine() are returned first
    * @param buffer byte array
    * @param size size of the buffer
    * @param flags
    * @return int bytes read
    */
   int read(byte* buffer, size_t size, int flags = 0);
+  /**
+   * @brief reads into several buffers with one call (recvmsg/WSARecv)
+   * @note buffered bytes left over from read()/readLine() are returned first
+   * @param buffers
+   * @param flags
+   * @return int bytes read
+   */
+  int read(std::span<const mutable_buffer> buffers, int flags = 0);
   /**
    * @brief reads a single byte
    *
@@ -278,9 +993,59 @@ public:
   /**
    * @brief reads a string up to a newline
    *
-   * @return std::string
+   * @return std::string line without the newline
    */
   std::string readLine();
+  /**
+   * @brief reads a string up to a newline into memory from resource
+   *
+   * @param resource e.g. &buffer_pool::global()
+   * @return std::pmr::string line without the newline
+   */
+  std::pmr::string readLine(std::pmr::memory_resource* resource);
+  /**
+   * @brief reads a line without copying it out of the receive buffer
+   * @note the view is valid until the next read on this socket
+   * @return std::string_view line without the newline
+   */
+  std::string_view readLineView();
+  /**
+   * @brief reads a line if one is buffered or can be read without blocking
+   * @note meant for non-blocking sockets; the view is valid until the next
+   * read on this socket
+   * @param[out] line line without the newline
+   * @return true if a line was read, false if the socket would block
+   */
+  bool try_readLine(std::string_view& line);
+
+  /**
+   * @brief reads one message without copying it out of the receive buffer
+   * @note the view is valid until the next read on this socket
+   * @param f framing of the stream (see Framing.hpp)
+   * @return std::string_view payload; throws socket_exception if the peer
+   * closes first or the frame is malformed
+   */
+  std::string_view read_frame(const framer& f);
+  /**
+   * @brief reads a message if one is buffered or can be read without
+   * blocking
+   * @note meant for non-blocking sockets; the view is valid until the next
+   * read on this socket
+   * @param f
+   * @param[out] payload
+   * @return true if a message was read, false if the socket would block
+   */
+  bool try_read_frame(const framer& f, std::string_view& payload);
+  /**
+   * @brief writes payload as one message, header and trailer are gathered
+   * into the same send
+   * @note blocking sockets write the whole frame; for non-blocking ones
+   * build the frame with framer::seal() and queue it instead
+   * @param f
+   * @param payload
+   * @return int bytes written including header and trailer, -1 on errors
+   */
+  int write_frame(const framer& f, std::string_view payload);
 };
 
 /**
@@ -291,14 +1056,46 @@ class tcp_server_socket : base_socket {
 private:
 public:
   tcp_server_socket(const char* port);
+  /**
+   * @brief listens on address and port
+   *
+   * @param address host name or ip to bind to, nullptr or "" for all
+   * interfaces
+   * @param port
+   * @param backlog maximum number of connections waiting for accept()
+   * @param reuse_port set SO_REUSEPORT so several sockets can listen on the
+   * same port and the kernel spreads connections over them (Linux, BSD)
+   */
+  tcp_server_socket(const char* address, const char* port,
+                    int backlog = SOMAXCONN, bool reuse_port = false);
   ~tcp_server_socket();
 
+  tcp_server_socket(tcp_server_socket&& other) noexcept;
   /**
-   * @brief accepts a tcp connection
+   * @brief stops listening and takes over other
    *
+   * @param other
+   * @return tcp_server_socket&
+   */
+  tcp_server_socket& operator=(tcp_server_socket&& other) noexcept;
+
+  using base_socket::native_handle;
+  using base_socket::set_blocking;
+
+  /**
+   * @brief accepts a tcp connection
+   * @note for tls call ssl_handshake() with a TLS_SERVER context on the
+   * returned socket, e.g. on a worker thread so accept() is not held up
    * @return tcp_socket
    */
   [[nodiscard]] tcp_socket accept();
+  /**
+   * @brief accepts a pending tcp connection without waiting
+   * @note meant for non-blocking servers (see set_blocking())
+   * @param[out] sock closed socket that takes the connection
+   * @return true if a connection was accepted
+   */
+  bool try_accept(tcp_socket& sock);
   /**
    * @brief stops listening
    *
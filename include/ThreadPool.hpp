@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace socketio {
+/**
+ * @brief work-stealing executor for handler work that shouldn't run on an I/O
+ * thread
+ * @note every worker runs its own queue first (oldest task first) and steals
+ * the newest tasks of other workers once it runs dry, so one busy queue
+ * doesn't leave the other cores idle
+ * @note tasks must not throw
+ */
+class thread_pool {
+public:
+  using task = std::function<void()>;
+
+  /**
+   * @brief awaitable that resumes the awaiting coroutine on the pool
+   *
+   */
+  class scheduler {
+    thread_pool& pool_;
+    size_t       worker_;
+
+  public:
+    scheduler(thread_pool& pool, size_t worker) noexcept
+        : pool_{ pool }
+        , worker_{ worker } {
+    }
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+      pool_.post(worker_, [h] { h.resume(); });
+    }
+
+    void await_resume() const noexcept {
+    }
+  };
+
+  /**
+   * @brief worker index meaning "any worker"
+   *
+   */
+  static constexpr size_t any_worker = static_cast<size_t>(-1);
+
+private:
+  struct worker {
+    std::mutex       mutex;
+    std::deque<task> tasks;
+    std::thread      thread;
+  };
+
+  std::vector<std::unique_ptr<worker>> workers_;
+
+  std::mutex              sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t>     pending_;
+  std::atomic<size_t>     next_;
+  bool                    stopping_;
+
+  void run(size_t index);
+  bool pop(size_t index, task& t);
+  bool steal(size_t index, task& t);
+
+public:
+  /**
+   * @brief starts the workers
+   *
+   * @param threads number of workers, 0 for one per core
+   */
+  explicit thread_pool(size_t threads = 0);
+  /**
+   * @brief runs the tasks still queued and joins the workers
+   *
+   */
+  ~thread_pool();
+
+  thread_pool(const thread_pool&)            = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  /**
+   * @brief queues a task
+   * @note from a worker it goes to that worker's queue, from other threads
+   * the workers take turns
+   * @note thread safe
+   * @param t
+   */
+  void post(task t);
+  /**
+   * @brief queues a task on a specific worker (unless another one steals it)
+   * @note use the index of the I/O thread (e.g. tcp_reactor_pool worker) that
+   * owns the connection to keep its work on the same core
+   * @param worker index below size(), or any_worker
+   * @param t
+   */
+  void post(size_t worker, task t);
+
+  /**
+   * @brief co_await to continue the coroutine on the pool
+   *
+   * @param worker preferred worker, or any_worker
+   * @return scheduler
+   */
+  scheduler schedule(size_t worker = any_worker);
+
+  /**
+   * @brief number of workers
+   *
+   * @return size_t
+   */
+  size_t size() const;
+  /**
+   * @brief index of the calling worker
+   *
+   * @return size_t any_worker if not called from a worker of this pool
+   */
+  size_t current_worker() const;
+};
+} // namespace socketio
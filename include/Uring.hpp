@@ -0,0 +1,214 @@
+#pragma once
+
+#include "EventLoop.hpp"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace socketio {
+/**
+ * @brief completion based I/O backend using io_uring on Linux
+ * @note operations are queued and submitted in batches by submit() and
+ * run_once(). If io_uring is unavailable (old kernel, seccomp, other OS) or a
+ * socket is secure, the same operations are served with send/recv from an
+ * event_loop instead.
+ * @note operations bypass the receive buffer of tcp_socket, don't mix them
+ * with readLine() on the same socket
+ */
+class uring {
+public:
+  /**
+   * @brief called with the bytes transferred or a negative errno
+   *
+   */
+  using completion = std::function<void(int result)>;
+  /**
+   * @brief called with the new connection, or a negative errno and a closed
+   * socket
+   */
+  using accept_handler = std::function<void(int result, tcp_socket sock)>;
+  /**
+   * @brief called with each received chunk; result is 0 once the peer closed
+   * and a negative errno on errors
+   * @note data is only valid during the call
+   */
+  using recv_handler = std::function<void(int result, std::string_view data)>;
+
+  /**
+   * @brief size of the kernel provided receive buffers used by read_stream()
+   *
+   */
+  static constexpr size_t recv_buffer_size = tcp_socket::read_chunk_size;
+  /**
+   * @brief number of kernel provided receive buffers
+   *
+   */
+  static constexpr unsigned recv_buffer_count = 64;
+
+private:
+  struct ring;
+  struct operation;
+  struct fallback_queue {
+    std::deque<operation*> reads;
+    std::deque<operation*> writes;
+  };
+
+  std::unique_ptr<ring> ring_;
+  event_loop            fallback_;
+
+  std::unordered_map<SOCKET, fallback_queue> queues_;
+  // submitted to the ring and not finally completed yet
+  std::unordered_set<operation*>             in_ring_;
+  std::vector<std::pair<byte*, size_t>>      buffers_;
+
+  size_t in_flight_;
+  bool   stopped_;
+  // a poll on the fallback's epoll descriptor is queued on the ring
+  bool   fallback_polled_;
+
+  operation* make(int kind, tcp_socket* sock, SOCKET fd);
+  void       start(operation* op);
+  void       finish(operation* op);
+  void       complete(operation* op, int result, unsigned int flags);
+
+  void enqueue_fallback(operation* op);
+  void update_fallback(SOCKET fd);
+  void handle_fallback(SOCKET fd, unsigned int events);
+  bool perform_fallback(operation* op);
+  void poll_fallback();
+  void drain_ring();
+
+public:
+  /**
+   * @brief sets up the submission and completion rings
+   *
+   * @param entries submission queue size (rounded up to a power of two)
+   */
+  explicit uring(unsigned int entries = 256);
+  ~uring();
+
+  uring(const uring&)            = delete;
+  uring& operator=(const uring&) = delete;
+
+  /**
+   * @brief is io_uring used (else the event_loop fallback)
+   *
+   * @return true
+   * @return false
+   */
+  bool is_supported() const;
+  /**
+   * @brief are multishot accept and receive available
+   *
+   * @return true
+   * @return false
+   */
+  bool has_multishot() const;
+
+  /**
+   * @brief registers buffers with the kernel for read_fixed() and
+   * write_fixed()
+   * @note replaces previously registered buffers
+   * @param buffers pointer/size pairs that outlive the uring
+   */
+  void register_buffers(const std::vector<std::pair<byte*, size_t>>& buffers);
+
+  /**
+   * @brief accepts connections until cancelled (multishot if available)
+   *
+   * @param server
+   * @param handler called once per connection
+   */
+  void accept(tcp_server_socket& server, accept_handler handler);
+  /**
+   * @brief receives at most size bytes into buffer
+   *
+   * @param sock
+   * @param buffer has to stay valid until completion
+   * @param size
+   * @param handler
+   */
+  void read(tcp_socket& sock, byte* buffer, size_t size, completion handler);
+  /**
+   * @brief sends at most size bytes from buffer
+   *
+   * @param sock
+   * @param buffer has to stay valid until completion
+   * @param size
+   * @param handler
+   */
+  void write(tcp_socket& sock, const byte* buffer, size_t size,
+             completion handler);
+  /**
+   * @brief receives into a registered buffer
+   *
+   * @param sock
+   * @param index index passed to register_buffers()
+   * @param offset offset into the registered buffer
+   * @param size
+   * @param handler
+   */
+  void read_fixed(tcp_socket& sock, unsigned int index, size_t offset,
+                  size_t size, completion handler);
+  /**
+   * @brief sends from a registered buffer
+   *
+   * @param sock
+   * @param index index passed to register_buffers()
+   * @param offset offset into the registered buffer
+   * @param size
+   * @param handler
+   */
+  void write_fixed(tcp_socket& sock, unsigned int index, size_t offset,
+                   size_t size, completion handler);
+  /**
+   * @brief receives continuously into kernel provided buffers (multishot if
+   * available) until the peer closes, an error occurs or it is cancelled
+   *
+   * @param sock
+   * @param handler
+   */
+  void read_stream(tcp_socket& sock, recv_handler handler);
+
+  /**
+   * @brief cancels all pending operations on a socket
+   * @note their handlers are called with -ECANCELED
+   * @param s
+   */
+  void cancel(SOCKET s);
+
+  /**
+   * @brief hands queued operations to the kernel without waiting
+   *
+   */
+  void submit();
+  /**
+   * @brief submits queued operations and waits for at least one completion
+   *
+   * @return int number of handled completions
+   */
+  int run_once();
+  /**
+   * @brief runs until no operation is pending or stop() is called
+   *
+   */
+  void run();
+  /**
+   * @brief makes run() return
+   * @note only call from a handler
+   */
+  void stop();
+
+  /**
+   * @brief number of operations that have not completed yet
+   *
+   * @return size_t
+   */
+  size_t pending() const;
+};
+} // namespace socketio
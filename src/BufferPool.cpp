@@ -0,0 +1,231 @@
+#include "BufferPool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr size_t class_count
+    = std::bit_width(socketio::buffer_pool::max_block_size
+                     / socketio::buffer_pool::min_block_size);
+// smallest slab carved into blocks, large classes get four blocks per slab
+constexpr size_t min_slab_size = 64 * 1024;
+
+std::atomic<uint64_t> next_pool_id{ 1 };
+
+// set once the thread's caches are destroyed, blocks allocated or freed
+// later (e.g. by static destructors) use the shared lists directly
+thread_local bool caches_destroyed{ false };
+
+size_t size_class(size_t bytes) {
+  if (bytes <= socketio::buffer_pool::min_block_size)
+    return 0;
+  return std::bit_width(bytes - 1)
+         - std::bit_width(socketio::buffer_pool::min_block_size - 1);
+}
+
+size_t class_size(size_t size_class) {
+  return socketio::buffer_pool::min_block_size << size_class;
+}
+
+size_t slab_size(size_t size_class) {
+  return std::max(min_slab_size, 4 * class_size(size_class));
+}
+} // namespace
+
+namespace socketio {
+struct buffer_pool::state {
+  std::pmr::memory_resource* upstream;
+  size_t                     thread_cache_size;
+  uint64_t                   id;
+
+  std::mutex                                  mutex;
+  std::array<std::vector<void*>, class_count> free;
+  std::vector<std::pair<void*, size_t>>       slabs;
+  size_t                                      reserved;
+
+  state(std::pmr::memory_resource* upstream, size_t thread_cache_size)
+      : upstream{ upstream }
+      , thread_cache_size{ std::max(thread_cache_size, size_t{ 1 }) }
+      , id{ next_pool_id++ }
+      , mutex{}
+      , free{}
+      , slabs{}
+      , reserved{ 0 } {
+  }
+
+  ~state() {
+    for (auto& [slab, size] : slabs) {
+      upstream->deallocate(slab, size, alignof(std::max_align_t));
+    }
+  }
+
+  /**
+   * @brief moves up to count free blocks into out, carving a new slab if
+   * there are none
+   */
+  void refill(size_t size_class, std::vector<void*>& out, size_t count) {
+    std::lock_guard<std::mutex> lock{ mutex };
+    std::vector<void*>&         blocks = free[size_class];
+    if (blocks.empty()) {
+      size_t size = slab_size(size_class);
+      auto*  slab = static_cast<std::byte*>(
+          upstream->allocate(size, alignof(std::max_align_t)));
+      slabs.emplace_back(slab, size);
+      reserved += size;
+      size_t block = class_size(size_class);
+      for (size_t offset = 0; offset + block <= size; offset += block) {
+        blocks.push_back(slab + offset);
+      }
+    }
+    size_t moved = std::min(count, blocks.size());
+    out.insert(out.end(), blocks.end() - static_cast<std::ptrdiff_t>(moved),
+               blocks.end());
+    blocks.resize(blocks.size() - moved);
+  }
+
+  /**
+   * @brief hands the last count blocks of in back to the shared list
+   *
+   */
+  void drain(size_t size_class, std::vector<void*>& in, size_t count) {
+    std::lock_guard<std::mutex> lock{ mutex };
+    std::vector<void*>&         blocks = free[size_class];
+    blocks.insert(blocks.end(), in.end() - static_cast<std::ptrdiff_t>(count),
+                  in.end());
+    in.resize(in.size() - count);
+  }
+
+  /**
+   * @brief single block for a thread without a cache
+   *
+   */
+  void* take(size_t size_class) {
+    std::vector<void*> block;
+    refill(size_class, block, 1);
+    return block.back();
+  }
+
+  /**
+   * @brief returns a block of a thread without a cache
+   *
+   */
+  void give(size_t size_class, void* block) {
+    std::lock_guard<std::mutex> lock{ mutex };
+    free[size_class].push_back(block);
+  }
+};
+
+struct buffer_pool::thread_cache {
+  std::weak_ptr<state>                        owner;
+  std::array<std::vector<void*>, class_count> free;
+
+  ~thread_cache() {
+    // blocks of a pool that is gone went away with its slabs
+    if (std::shared_ptr<state> pool = owner.lock()) {
+      for (size_t i = 0; i < class_count; ++i) {
+        if (!free[i].empty())
+          pool->drain(i, free[i], free[i].size());
+      }
+    }
+  }
+};
+
+buffer_pool::buffer_pool(std::pmr::memory_resource* upstream,
+                         size_t                     thread_cache_size)
+    : state_{ std::make_shared<state>(upstream, thread_cache_size) } {
+}
+
+buffer_pool::~buffer_pool() {
+}
+
+buffer_pool& buffer_pool::global() {
+  static buffer_pool* pool = new buffer_pool{};
+  return *pool;
+}
+
+std::pmr::memory_resource* buffer_pool::upstream() const {
+  return state_->upstream;
+}
+
+size_t buffer_pool::reserved() const {
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  return state_->reserved;
+}
+
+buffer_pool::thread_cache* buffer_pool::local_cache() const {
+  struct caches {
+    std::unordered_map<uint64_t, thread_cache> pools;
+    uint64_t                                   last_id{ 0 };
+    thread_cache*                              last{ nullptr };
+
+    ~caches() {
+      caches_destroyed = true;
+    }
+  };
+  if (caches_destroyed)
+    return nullptr;
+  thread_local caches local{};
+
+  if (local.last_id == state_->id)
+    return local.last;
+  auto it = local.pools.find(state_->id);
+  if (it == local.pools.end()) {
+    std::erase_if(local.pools, [](const auto& entry) {
+      return entry.second.owner.expired();
+    });
+    it               = local.pools.try_emplace(state_->id).first;
+    it->second.owner = state_;
+  }
+  local.last_id = state_->id;
+  local.last    = &it->second;
+  return local.last;
+}
+
+void* buffer_pool::do_allocate(size_t bytes, size_t alignment) {
+  if (bytes > max_block_size || alignment > alignof(std::max_align_t))
+    return state_->upstream->allocate(bytes, alignment);
+  size_t        size_class = ::size_class(bytes);
+  thread_cache* cache      = local_cache();
+  if (!cache)
+    return state_->take(size_class);
+  std::vector<void*>& blocks = cache->free[size_class];
+  if (blocks.empty()) {
+    state_->refill(size_class, blocks,
+                   std::max(state_->thread_cache_size / 2, size_t{ 1 }));
+  }
+  void* block = blocks.back();
+  blocks.pop_back();
+  return block;
+}
+
+void buffer_pool::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  if (bytes > max_block_size || alignment > alignof(std::max_align_t)) {
+    state_->upstream->deallocate(p, bytes, alignment);
+    return;
+  }
+  size_t        size_class = ::size_class(bytes);
+  thread_cache* cache      = local_cache();
+  if (!cache) {
+    state_->give(size_class, p);
+    return;
+  }
+  std::vector<void*>& blocks = cache->free[size_class];
+  blocks.push_back(p);
+  if (blocks.size() > state_->thread_cache_size) {
+    state_->drain(size_class, blocks,
+                  blocks.size() - state_->thread_cache_size / 2);
+  }
+}
+
+bool buffer_pool::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+} // namespace socketio
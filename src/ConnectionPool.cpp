@@ -0,0 +1,260 @@
+#include "ConnectionPool.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+namespace {
+using idle_clock = std::chrono::steady_clock;
+
+/**
+ * @brief can an idle connection be reused
+ * @note an idle socket that is readable (or has buffered input) was closed
+ * by the peer or has data nobody asked for, neither is safe to hand out
+ */
+bool is_healthy(const socketio::tcp_socket& sock) {
+  if (!sock.is_valid() || sock.buffered_input())
+    return false;
+  pollfd pfd{};
+  pfd.fd     = sock.native_handle();
+  pfd.events = POLLIN;
+#ifdef _WIN32
+  return WSAPoll(&pfd, 1, 0) == 0;
+#else
+  return ::poll(&pfd, 1, 0) == 0;
+#endif
+}
+} // namespace
+
+namespace socketio {
+struct connection_pool::state {
+  struct idle_connection {
+    tcp_socket        sock;
+    idle_clock::time_point since;
+  };
+
+  struct host {
+    std::deque<idle_connection> idle;
+    size_t                      open{ 0 };
+    // waiters for a slot of this host only
+    std::condition_variable     released{};
+  };
+
+  std::mutex                            mutex;
+  std::unordered_map<std::string, host> hosts;
+
+  size_t                     max_per_host;
+  std::chrono::milliseconds  idle_timeout;
+  std::optional<tls_context> tls;
+  bool                       closed;
+
+  state(size_t max_per_host, std::chrono::milliseconds idle_timeout)
+      : mutex{}
+      , hosts{}
+      , max_per_host{ max_per_host }
+      , idle_timeout{ idle_timeout }
+      , tls{}
+      , closed{ false } {
+  }
+
+  /**
+   * @brief moves idle connections of h that timed out to closing
+   * @note call with mutex held, close them once it is released (a TLS
+   * shutdown may block)
+   */
+  void evict(host& h, idle_clock::time_point now,
+             std::vector<tcp_socket>& closing) {
+    // oldest first, reuse takes the most recent ones from the back
+    while (!h.idle.empty() && now - h.idle.front().since > idle_timeout) {
+      closing.push_back(std::move(h.idle.front().sock));
+      h.idle.pop_front();
+      --h.open;
+      h.released.notify_one();
+    }
+  }
+
+  /**
+   * @brief moves all idle connections to closing
+   * @note call with mutex held
+   */
+  void drop_idle(std::vector<tcp_socket>& closing) {
+    for (auto& [key, h] : hosts) {
+      for (idle_connection& conn : h.idle)
+        closing.push_back(std::move(conn.sock));
+      h.open -= h.idle.size();
+      h.idle.clear();
+      h.released.notify_all();
+    }
+  }
+
+  void release(const std::string& key, tcp_socket sock) {
+    // a socket that is not kept closes with the parameter, after the lock
+    std::lock_guard<std::mutex> lock{ mutex };
+    host&                       h = hosts[key];
+    if (!closed && sock.is_valid()) {
+      h.idle.push_back({ std::move(sock), idle_clock::now() });
+    } else {
+      --h.open;
+    }
+    h.released.notify_one();
+  }
+};
+
+connection_pool::connection::connection(std::shared_ptr<state> pool,
+                                        std::string key, tcp_socket sock,
+                                        bool reused)
+    : pool_{ std::move(pool) }
+    , key_{ std::move(key) }
+    , sock_{ std::move(sock) }
+    , reused_{ reused } {
+}
+
+connection_pool::connection::connection(connection&& other) noexcept
+    : pool_{ std::move(other.pool_) }
+    , key_{ std::move(other.key_) }
+    , sock_{ std::move(other.sock_) }
+    , reused_{ other.reused_ } {
+}
+
+connection_pool::connection&
+connection_pool::connection::operator=(connection&& other) noexcept {
+  if (this != &other) {
+    if (pool_)
+      pool_->release(key_, std::move(sock_));
+    pool_   = std::move(other.pool_);
+    key_    = std::move(other.key_);
+    sock_   = std::move(other.sock_);
+    reused_ = other.reused_;
+  }
+  return *this;
+}
+
+connection_pool::connection::~connection() {
+  if (pool_)
+    pool_->release(key_, std::move(sock_));
+}
+
+tcp_socket& connection_pool::connection::operator*() {
+  return sock_;
+}
+
+tcp_socket* connection_pool::connection::operator->() {
+  return &sock_;
+}
+
+bool connection_pool::connection::reused() const {
+  return reused_;
+}
+
+void connection_pool::connection::discard() {
+  sock_.close();
+}
+
+connection_pool::connection_pool(size_t                    max_per_host,
+                                 std::chrono::milliseconds idle_timeout)
+    : state_{ std::make_shared<state>(max_per_host, idle_timeout) } {
+}
+
+connection_pool::~connection_pool() {
+  std::vector<tcp_socket>     closing{};
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  state_->closed = true;
+  state_->drop_idle(closing);
+}
+
+void connection_pool::set_tls(const tls_context& ctx) {
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  state_->tls = ctx;
+}
+
+connection_pool::connection connection_pool::acquire(const std::string& domain,
+                                                     const std::string& port,
+                                                     int timeout_ms) {
+  std::string key      = domain + ":" + port;
+  auto        deadline = idle_clock::now()
+                + std::chrono::milliseconds{ std::max(timeout_ms, 0) };
+  // declared before the lock so they are closed after it is released
+  std::vector<tcp_socket>      closing{};
+  std::unique_lock<std::mutex> lock{ state_->mutex };
+  state::host&                 h = state_->hosts[key];
+  while (true) {
+    state_->evict(h, idle_clock::now(), closing);
+    while (!h.idle.empty()) {
+      tcp_socket sock = std::move(h.idle.back().sock);
+      h.idle.pop_back();
+      if (is_healthy(sock))
+        return connection{ state_, key, std::move(sock), true };
+      closing.push_back(std::move(sock));
+      --h.open;
+    }
+    if (h.open < state_->max_per_host)
+      break;
+    if (timeout_ms < 0) {
+      h.released.wait(lock);
+    } else if (h.released.wait_until(lock, deadline)
+               == std::cv_status::timeout) {
+      throw socket_exception{ "Timed out waiting for a connection to "
+                              + key };
+    }
+  }
+
+  // connect without holding up other hosts, the slot is taken already
+  ++h.open;
+  std::optional<tls_context> tls = state_->tls;
+  lock.unlock();
+  closing.clear();
+  try {
+    tcp_socket sock{};
+    sock.connect(domain.c_str(), port.c_str());
+    if (tls)
+      sock.ssl_handshake(*tls);
+    return connection{ state_, key, std::move(sock), false };
+  } catch (...) {
+    lock.lock();
+    --h.open;
+    h.released.notify_one();
+    throw;
+  }
+}
+
+void connection_pool::evict_idle() {
+  std::vector<tcp_socket>     closing{};
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  auto                        now = idle_clock::now();
+  for (auto& [key, h] : state_->hosts) {
+    state_->evict(h, now, closing);
+  }
+}
+
+void connection_pool::clear() {
+  std::vector<tcp_socket>     closing{};
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  state_->drop_idle(closing);
+}
+
+size_t connection_pool::idle() const {
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  size_t                      count{ 0 };
+  for (const auto& [key, h] : state_->hosts) {
+    count += h.idle.size();
+  }
+  return count;
+}
+
+size_t connection_pool::open() const {
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  size_t                      count{ 0 };
+  for (const auto& [key, h] : state_->hosts) {
+    count += h.open;
+  }
+  return count;
+}
+} // namespace socketio
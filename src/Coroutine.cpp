@@ -0,0 +1,227 @@
+#include "Coroutine.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+
+namespace {
+// lookups mostly wait on the network, a few run side by side
+constexpr size_t resolver_threads = 4;
+
+/**
+ * @brief workers for async_resolve()
+ * @note never destroyed, lookups still running at exit are abandoned
+ */
+socketio::thread_pool& resolver_pool() {
+  static socketio::thread_pool* pool
+      = new socketio::thread_pool{ resolver_threads };
+  return *pool;
+}
+
+/**
+ * @brief eagerly started coroutine that frees itself at the end
+ *
+ */
+struct detached {
+  struct promise_type {
+    detached get_return_object() const noexcept {
+      return {};
+    }
+
+    std::suspend_never initial_suspend() const noexcept {
+      return {};
+    }
+
+    std::suspend_never final_suspend() const noexcept {
+      return {};
+    }
+
+    void return_void() const noexcept {
+    }
+
+    // with suspend_never at the end a rethrow would skip destroying the
+    // frame, so treat it like an exception escaping a std::thread
+    void unhandled_exception() const noexcept {
+      std::terminate();
+    }
+  };
+};
+
+detached run_detached(socketio::task<void> t) {
+  co_await std::move(t);
+}
+} // namespace
+
+namespace socketio {
+void spawn(task<void> t) {
+  run_detached(std::move(t));
+}
+
+loop_scheduler resume_on(event_loop& loop) {
+  return loop_scheduler{ loop };
+}
+
+readiness readable(event_loop& loop, SOCKET sock) {
+  return { loop, sock, READABLE };
+}
+
+readiness writable(event_loop& loop, SOCKET sock) {
+  return { loop, sock, WRITABLE };
+}
+
+struct resolution::lookup {
+  std::string             domain;
+  std::string             port;
+  std::optional<endpoint> result;
+  std::exception_ptr      error;
+  // the awaiting coroutine went away, its handle must not be resumed
+  std::atomic<bool>       abandoned{ false };
+};
+
+resolution::resolution(event_loop& loop, std::string domain,
+                       std::string port)
+    : loop_{ loop }
+    , domain_{ std::move(domain) }
+    , port_{ std::move(port) }
+    , result_{}
+    , lookup_{} {
+}
+
+resolution::~resolution() {
+  // also runs when the frame is destroyed while the lookup is pending
+  if (lookup_)
+    lookup_->abandoned = true;
+}
+
+bool resolution::await_ready() {
+  result_ = endpoint::cached(domain_, port_);
+  return result_.has_value();
+}
+
+void resolution::await_suspend(std::coroutine_handle<> h) {
+  lookup_         = std::make_shared<lookup>();
+  lookup_->domain = domain_;
+  lookup_->port   = port_;
+  // the loop may be destroyed before the lookup finishes
+  resolver_pool().post([state = lookup_, alive = loop_.lifetime_, h] {
+    try {
+      state->result.emplace(state->domain, state->port.c_str());
+    } catch (...) {
+      state->error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock{ alive->mutex };
+    if (!alive->loop)
+      return;
+    alive->loop->post([state, h] {
+      if (!state->abandoned)
+        h.resume();
+    });
+  });
+}
+
+endpoint resolution::await_resume() {
+  if (!lookup_)
+    return std::move(*result_);
+  if (lookup_->error)
+    std::rethrow_exception(lookup_->error);
+  return std::move(*lookup_->result);
+}
+
+resolution async_resolve(event_loop& loop, std::string domain,
+                         std::string port) {
+  return { loop, std::move(domain), std::move(port) };
+}
+
+task<void> async_connect(event_loop& loop, tcp_socket& sock,
+                         std::string domain, std::string port) {
+  endpoint    ept = co_await async_resolve(loop, std::move(domain),
+                                           std::move(port));
+  std::string error_string{ "Unable to connect" };
+  for (addrinfo* cur_addr_info = ept; cur_addr_info != nullptr;
+       cur_addr_info           = cur_addr_info->ai_next) {
+    try {
+      if (!sock.start_connect(cur_addr_info)) {
+        co_await writable(loop, sock.native_handle());
+        sock.finish_connect();
+      }
+      co_return;
+    } catch (const socket_exception& e) {
+      error_string = e.what();
+    }
+  }
+  throw socket_exception{ error_string };
+}
+
+task<void> async_ssl_handshake(event_loop& loop, tcp_socket& sock,
+                               tls_context ctx) {
+  for (handshake_state state = sock.start_ssl_handshake(ctx);
+       state != HANDSHAKE_DONE; state = sock.continue_ssl_handshake()) {
+    if (state == HANDSHAKE_WANT_WRITE)
+      co_await writable(loop, sock.native_handle());
+    else
+      co_await readable(loop, sock.native_handle());
+  }
+}
+
+task<tcp_socket> async_accept(event_loop& loop, tcp_server_socket& server) {
+  tcp_socket sock{};
+  while (true) {
+    if (server.try_accept(sock)) {
+      sock.set_blocking(false);
+      co_return std::move(sock);
+    }
+    co_await readable(loop, server.native_handle());
+  }
+}
+
+task<int> async_read(event_loop& loop, tcp_socket& sock, byte* buffer,
+                     size_t size) {
+  while (true) {
+    int read = sock.read(buffer, size, MSG_DONTWAIT);
+    if (read >= 0)
+      co_return read;
+    if (!would_block())
+      co_return -1;
+    co_await readable(loop, sock.native_handle());
+  }
+}
+
+task<int> async_write(event_loop& loop, tcp_socket& sock, const byte* buffer,
+                      size_t size) {
+  size_t written{ 0 };
+  while (written < size) {
+    int sent = sock.write(buffer + written, size - written, MSG_DONTWAIT);
+    if (sent > 0) {
+      written += static_cast<size_t>(sent);
+      continue;
+    }
+    if (sent < 0 && !would_block())
+      co_return -1;
+    co_await writable(loop, sock.native_handle());
+  }
+  co_return static_cast<int>(written);
+}
+
+task<int> async_write(event_loop& loop, tcp_socket& sock, std::string str) {
+  co_return co_await async_write(loop, sock, (const byte*) str.data(),
+                                 str.size());
+}
+
+task<std::string> async_read_line(event_loop& loop, tcp_socket& sock) {
+  std::string_view line{};
+  while (!sock.try_readLine(line)) {
+    co_await readable(loop, sock.native_handle());
+  }
+  co_return std::string{ line };
+}
+
+task<std::string_view> async_read_frame(event_loop& loop, tcp_socket& sock,
+                                        const framer& f) {
+  std::string_view payload{};
+  while (!sock.try_read_frame(f, payload)) {
+    co_await readable(loop, sock.native_handle());
+  }
+  co_return payload;
+}
+} // namespace socketio
@@ -0,0 +1,502 @@
+#include "EventLoop.hpp"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+namespace {
+constexpr int max_events = 64;
+
+#if defined(__linux__)
+uint32_t to_epoll(unsigned int events) {
+  uint32_t flags = EPOLLRDHUP;
+  if (events & socketio::READABLE)
+    flags |= EPOLLIN;
+  if (events & socketio::WRITABLE)
+    flags |= EPOLLOUT;
+  return flags;
+}
+#endif
+
+#ifdef _WIN32
+// WSAPoll can not be woken up, so post() and stop() are noticed within this
+constexpr int max_poll_timeout_ms = 50;
+#endif
+} // namespace
+
+namespace socketio {
+event_loop::event_loop()
+    : handlers_{}
+    , tasks_{}
+    , tasks_mutex_{}
+    , stopped_{ false }
+    , lifetime_{ std::make_shared<lifetime>() } {
+  lifetime_->loop = this;
+#if defined(__linux__)
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    throw socket_exception{ "Unable to create epoll instance: "
+                            + std::string{ strerror(errno) } };
+  }
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd_ == -1) {
+    ::close(epoll_fd_);
+    throw socket_exception{ "Unable to create eventfd: "
+                            + std::string{ strerror(errno) } };
+  }
+  epoll_event ev{};
+  ev.events  = EPOLLIN;
+  ev.data.fd = wake_fd_;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+#elif !defined(_WIN32)
+  if (pipe(wake_pipe_) == -1) {
+    throw socket_exception{ "Unable to create wake pipe: "
+                            + std::string{ strerror(errno) } };
+  }
+  fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+#endif
+}
+
+event_loop::~event_loop() {
+  {
+    // waits for a post() from another thread that is already under way
+    std::lock_guard<std::mutex> lock{ lifetime_->mutex };
+    lifetime_->loop = nullptr;
+  }
+#if defined(__linux__)
+  ::close(wake_fd_);
+  ::close(epoll_fd_);
+#elif !defined(_WIN32)
+  ::close(wake_pipe_[0]);
+  ::close(wake_pipe_[1]);
+#endif
+}
+
+void event_loop::add(SOCKET s, unsigned int events, callback cb) {
+  std::shared_ptr<handler>& h = handlers_[s];
+  if (!h)
+    h = std::make_shared<handler>();
+  h->events = events;
+  h->cb     = std::move(cb);
+  try {
+    arm(s, *h);
+  } catch (...) {
+    handlers_.erase(s);
+    throw;
+  }
+}
+
+void event_loop::modify(SOCKET s, unsigned int events) {
+  auto it = handlers_.find(s);
+  if (it == handlers_.end())
+    return;
+  it->second->events = events;
+  arm(s, *it->second);
+}
+
+void event_loop::remove(SOCKET s) {
+  auto it = handlers_.find(s);
+  if (it == handlers_.end())
+    return;
+  bool registered = it->second->registered;
+  handlers_.erase(it);
+#if defined(__linux__)
+  // fails harmlessly if the socket has already been closed
+  if (registered)
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, s, nullptr);
+#else
+  (void) registered;
+#endif
+}
+
+void event_loop::wait(SOCKET s, io_event event, task t) {
+  std::shared_ptr<handler>& h = handlers_[s];
+  if (!h)
+    h = std::make_shared<handler>();
+  if (event == WRITABLE)
+    h->on_writable = std::move(t);
+  else
+    h->on_readable = std::move(t);
+  arm(s, *h);
+}
+
+unsigned int event_loop::wanted(const handler& h) {
+  unsigned int events = h.events;
+  if (h.on_readable)
+    events |= READABLE;
+  if (h.on_writable)
+    events |= WRITABLE;
+  return events;
+}
+
+void event_loop::arm(SOCKET s, handler& h) {
+  unsigned int events = wanted(h);
+  if (!h.cb && !events) {
+    remove(s);
+    return;
+  }
+  if (h.registered && h.armed == events)
+    return;
+#if defined(__linux__)
+  epoll_event ev{};
+  ev.events  = to_epoll(events);
+  ev.data.fd = s;
+  // the socket may have been closed and its number reused since it was
+  // registered, so fall back between ADD and MOD
+  int  op = h.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  bool ok = epoll_ctl(epoll_fd_, op, s, &ev) == 0;
+  if (!ok && op == EPOLL_CTL_MOD && errno == ENOENT)
+    ok = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, s, &ev) == 0;
+  else if (!ok && op == EPOLL_CTL_ADD && errno == EEXIST)
+    ok = epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, s, &ev) == 0;
+  if (!ok) {
+    throw socket_exception{ "Unable to watch socket: "
+                            + std::string{ strerror(errno) } };
+  }
+#endif
+  h.armed      = events;
+  h.registered = true;
+}
+
+void event_loop::post(task t) {
+  {
+    std::lock_guard<std::mutex> lock{ tasks_mutex_ };
+    tasks_.push_back(std::move(t));
+  }
+  wake();
+}
+
+void event_loop::wake() {
+#if defined(__linux__)
+  uint64_t one = 1;
+  [[maybe_unused]] auto written = ::write(wake_fd_, &one, sizeof(one));
+#elif !defined(_WIN32)
+  byte one = 1;
+  [[maybe_unused]] auto written = ::write(wake_pipe_[1], &one, 1);
+#endif
+}
+
+void event_loop::drain_wake() {
+#if defined(__linux__)
+  uint64_t count;
+  [[maybe_unused]] auto read = ::read(wake_fd_, &count, sizeof(count));
+#elif !defined(_WIN32)
+  byte buffer[64];
+  while (::read(wake_pipe_[0], buffer, sizeof(buffer)) > 0)
+    ;
+#endif
+}
+
+void event_loop::run_tasks() {
+  std::vector<task> tasks;
+  {
+    std::lock_guard<std::mutex> lock{ tasks_mutex_ };
+    tasks.swap(tasks_);
+  }
+  for (auto& t : tasks) {
+    t();
+  }
+}
+
+void event_loop::dispatch(SOCKET s, unsigned int events) {
+  auto it = handlers_.find(s);
+  if (it == handlers_.end())
+    return;
+  // keep the handler alive in case a callback removes it
+  std::shared_ptr<handler> h = it->second;
+
+  // interest is dropped lazily: only once it fires without anyone waiting,
+  // so a waiter that waits again right away keeps its registration
+  unsigned int interest = wanted(*h);
+  bool         unwanted = (events & ~(interest | CLOSED))
+               || ((events & CLOSED) && !h->cb && !interest);
+
+  // only the waiters of fired events run, the other one stays registered
+  task readable{};
+  task writable{};
+  if (events & (READABLE | CLOSED)) {
+    readable       = std::move(h->on_readable);
+    h->on_readable = nullptr;
+  }
+  if (events & (WRITABLE | CLOSED)) {
+    writable       = std::move(h->on_writable);
+    h->on_writable = nullptr;
+  }
+
+  unsigned int persistent = events & (h->events | CLOSED);
+  if (h->cb && persistent)
+    h->cb(persistent);
+
+  auto current = handlers_.find(s);
+  if (unwanted && current != handlers_.end() && current->second == h)
+    arm(s, *h);
+
+  if (readable)
+    readable();
+  if (writable)
+    writable();
+}
+
+int event_loop::run_once(int timeout_ms) {
+  {
+    std::lock_guard<std::mutex> lock{ tasks_mutex_ };
+    if (!tasks_.empty())
+      timeout_ms = 0;
+  }
+  int dispatched{ 0 };
+#if defined(__linux__)
+  epoll_event events[max_events];
+  int         count = epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+  if (count == -1 && errno != EINTR) {
+    throw socket_exception{ "Error waiting for events: "
+                            + std::string{ strerror(errno) } };
+  }
+  for (int i = 0; i < count; ++i) {
+    if (events[i].data.fd == wake_fd_) {
+      drain_wake();
+      continue;
+    }
+    unsigned int flags{ 0 };
+    if (events[i].events & EPOLLIN)
+      flags |= READABLE;
+    if (events[i].events & EPOLLOUT)
+      flags |= WRITABLE;
+    if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      flags |= CLOSED;
+    dispatch(events[i].data.fd, flags);
+    ++dispatched;
+  }
+#else
+  std::vector<pollfd> fds{};
+  fds.reserve(handlers_.size() + 1);
+#ifdef _WIN32
+  if (timeout_ms < 0 || timeout_ms > max_poll_timeout_ms)
+    timeout_ms = max_poll_timeout_ms;
+#else
+  fds.push_back({ wake_pipe_[0], POLLIN, 0 });
+#endif
+  for (const auto& [s, h] : handlers_) {
+    unsigned int interest = wanted(*h);
+    short        events{ 0 };
+    if (interest & READABLE)
+      events |= POLLIN;
+    if (interest & WRITABLE)
+      events |= POLLOUT;
+    fds.push_back({ s, events, 0 });
+  }
+#ifdef _WIN32
+  int count = fds.empty() ? (Sleep(timeout_ms), 0)
+                          : WSAPoll(fds.data(), (ULONG) fds.size(), timeout_ms);
+#else
+  int count = poll(fds.data(), fds.size(), timeout_ms);
+#endif
+  if (count == SOCKET_ERROR && errno != EINTR) {
+    throw socket_exception{ "Error waiting for events" };
+  }
+  for (size_t i = 0; count > 0 && i < fds.size(); ++i) {
+    if (!fds[i].revents)
+      continue;
+#ifndef _WIN32
+    if (i == 0) {
+      drain_wake();
+      continue;
+    }
+#endif
+    unsigned int flags{ 0 };
+    if (fds[i].revents & POLLIN)
+      flags |= READABLE;
+    if (fds[i].revents & POLLOUT)
+      flags |= WRITABLE;
+    if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+      flags |= CLOSED;
+    dispatch(fds[i].fd, flags);
+    ++dispatched;
+  }
+#endif
+  run_tasks();
+  return dispatched;
+}
+
+void event_loop::run() {
+  while (!stopped_.load()) {
+    run_once();
+  }
+  stopped_ = false;
+}
+
+void event_loop::stop() {
+  stopped_ = true;
+  wake();
+}
+
+tcp_reactor::tcp_reactor(event_loop& loop, const char* port)
+    : tcp_reactor{ loop, tcp_server_socket{ port } } {
+}
+
+tcp_reactor::tcp_reactor(event_loop& loop, tcp_server_socket server)
+    : loop_{ loop }
+    , server_{ std::move(server) }
+    , connections_{}
+    , closing_{}
+    , dispatching_{ false } {
+  server_.set_blocking(false);
+  loop_.add(server_.native_handle(), READABLE,
+            [this](unsigned int) { accept_all(); });
+}
+
+tcp_reactor::~tcp_reactor() {
+  for (const auto& [s, conn] : connections_) {
+    loop_.remove(s);
+  }
+  loop_.remove(server_.native_handle());
+}
+
+void tcp_reactor::on_accept(handler h) {
+  on_accept_ = std::move(h);
+}
+
+void tcp_reactor::on_readable(handler h) {
+  on_readable_ = std::move(h);
+}
+
+void tcp_reactor::on_writable(handler h) {
+  on_writable_ = std::move(h);
+}
+
+void tcp_reactor::on_closed(handler h) {
+  on_closed_ = std::move(h);
+}
+
+void tcp_reactor::accept_all() {
+  dispatching_ = true;
+  while (true) {
+    tcp_socket conn{};
+    if (!server_.try_accept(conn))
+      break;
+    conn.set_blocking(false);
+    SOCKET      s   = conn.native_handle();
+    tcp_socket& ref = connections_.emplace(s, std::move(conn)).first->second;
+    loop_.add(s, READABLE,
+              [this, s](unsigned int events) { handle(s, events); });
+    if (on_accept_)
+      on_accept_(ref);
+  }
+  dispatching_ = false;
+  closing_.clear();
+}
+
+void tcp_reactor::handle(SOCKET s, unsigned int events) {
+  auto it = connections_.find(s);
+  if (it == connections_.end())
+    return;
+  tcp_socket& conn = it->second;
+
+  dispatching_ = true;
+  if ((events & READABLE) && on_readable_)
+    on_readable_(conn);
+  if ((events & WRITABLE) && on_writable_ && connections_.count(s))
+    on_writable_(conn);
+  if ((events & CLOSED) && connections_.count(s)) {
+    if (on_closed_)
+      on_closed_(conn);
+    close(conn);
+  }
+  dispatching_ = false;
+  closing_.clear();
+}
+
+void tcp_reactor::want_write(tcp_socket& sock, bool enable) {
+  loop_.modify(sock.native_handle(),
+               enable ? READABLE | WRITABLE : READABLE);
+}
+
+void tcp_reactor::close(tcp_socket& sock) {
+  SOCKET s  = sock.native_handle();
+  auto   it = connections_.find(s);
+  if (it == connections_.end())
+    return;
+  loop_.remove(s);
+  auto conn = connections_.extract(it);
+  if (dispatching_)
+    closing_.push_back(std::move(conn));
+}
+
+size_t tcp_reactor::size() const {
+  return connections_.size();
+}
+
+tcp_reactor_pool::tcp_reactor_pool(const char* address, const char* port,
+                                   size_t threads, int backlog)
+    : workers_{} {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < threads; ++i) {
+    auto w     = std::make_unique<worker>();
+    w->reactor = std::make_unique<tcp_reactor>(
+        w->loop, tcp_server_socket{ address, port, backlog, true });
+    workers_.push_back(std::move(w));
+  }
+}
+
+tcp_reactor_pool::~tcp_reactor_pool() {
+  stop();
+}
+
+void tcp_reactor_pool::on_accept(handler h) {
+  for (auto& w : workers_) {
+    w->reactor->on_accept(
+        [h, &r = *w->reactor](tcp_socket& sock) { h(r, sock); });
+  }
+}
+
+void tcp_reactor_pool::on_readable(handler h) {
+  for (auto& w : workers_) {
+    w->reactor->on_readable(
+        [h, &r = *w->reactor](tcp_socket& sock) { h(r, sock); });
+  }
+}
+
+void tcp_reactor_pool::on_writable(handler h) {
+  for (auto& w : workers_) {
+    w->reactor->on_writable(
+        [h, &r = *w->reactor](tcp_socket& sock) { h(r, sock); });
+  }
+}
+
+void tcp_reactor_pool::on_closed(handler h) {
+  for (auto& w : workers_) {
+    w->reactor->on_closed(
+        [h, &r = *w->reactor](tcp_socket& sock) { h(r, sock); });
+  }
+}
+
+void tcp_reactor_pool::start() {
+  for (auto& w : workers_) {
+    if (!w->thread.joinable())
+      w->thread = std::thread{ [&loop = w->loop] { loop.run(); } };
+  }
+}
+
+void tcp_reactor_pool::stop() {
+  for (auto& w : workers_) {
+    if (w->thread.joinable()) {
+      w->loop.stop();
+      w->thread.join();
+    }
+  }
+}
+
+size_t tcp_reactor_pool::size() const {
+  return workers_.size();
+}
+
+event_loop& tcp_reactor_pool::loop(size_t index) {
+  return workers_.at(index)->loop;
+}
+} // namespace socketio
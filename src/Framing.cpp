@@ -0,0 +1,148 @@
+#include "Framing.hpp"
+
+#include <cstring>
+
+namespace socketio {
+std::string_view framer::trailer() const {
+  return {};
+}
+
+std::span<const byte> framer::seal(byte* payload, size_t size) const {
+  byte   header[header_capacity];
+  size_t header_size = encode_header(size, header);
+  byte*  begin       = payload - header_size;
+  memcpy(begin, header, header_size);
+  std::string_view tail = trailer();
+  if (!tail.empty())
+    memcpy(payload + size, tail.data(), tail.size());
+  return { begin, header_size + size + tail.size() };
+}
+
+length_prefix_framer::length_prefix_framer(size_t width, bool big_endian,
+                                           size_t max_size)
+    : width_{ width }
+    , big_endian_{ big_endian }
+    , max_size_{ max_size } {
+  if (width != 1 && width != 2 && width != 4 && width != 8) {
+    throw socket_exception{ "Length prefix has to be 1, 2, 4 or 8 bytes" };
+  }
+}
+
+size_t length_prefix_framer::decode(std::string_view  data,
+                                    std::string_view& payload, size_t) const {
+  if (data.size() < width_)
+    return 0;
+  uint64_t size{ 0 };
+  for (size_t i = 0; i < width_; ++i) {
+    size_t shift = big_endian_ ? (width_ - 1 - i) * 8 : i * 8;
+    size |= uint64_t{ static_cast<byte>(data[i]) } << shift;
+  }
+  if (size > max_size_) {
+    throw socket_exception{ "Frame of " + std::to_string(size)
+                            + " bytes exceeds the limit" };
+  }
+  if (data.size() - width_ < size)
+    return 0;
+  payload = data.substr(width_, static_cast<size_t>(size));
+  return width_ + static_cast<size_t>(size);
+}
+
+size_t length_prefix_framer::encode_header(size_t size, byte* header) const {
+  if (size > max_size_ || (width_ < 8 && (size >> (width_ * 8)) != 0)) {
+    throw socket_exception{ "Frame of " + std::to_string(size)
+                            + " bytes exceeds the limit" };
+  }
+  for (size_t i = 0; i < width_; ++i) {
+    size_t shift = big_endian_ ? (width_ - 1 - i) * 8 : i * 8;
+    header[i]    = static_cast<byte>(uint64_t{ size } >> shift);
+  }
+  return width_;
+}
+
+varint_framer::varint_framer(size_t max_size)
+    : max_size_{ max_size } {
+}
+
+size_t varint_framer::decode(std::string_view  data,
+                             std::string_view& payload, size_t) const {
+  uint64_t size{ 0 };
+  size_t   header{ 0 };
+  while (true) {
+    if (header == data.size())
+      return 0;
+    if (header == header_capacity) {
+      throw socket_exception{ "Malformed varint frame length" };
+    }
+    auto b = static_cast<byte>(data[header]);
+    size |= uint64_t{ b & 0x7fu } << (7 * header);
+    ++header;
+    if (!(b & 0x80))
+      break;
+  }
+  if (size > max_size_) {
+    throw socket_exception{ "Frame of " + std::to_string(size)
+                            + " bytes exceeds the limit" };
+  }
+  if (data.size() - header < size)
+    return 0;
+  payload = data.substr(header, static_cast<size_t>(size));
+  return header + static_cast<size_t>(size);
+}
+
+size_t varint_framer::encode_header(size_t size, byte* header) const {
+  if (size > max_size_) {
+    throw socket_exception{ "Frame of " + std::to_string(size)
+                            + " bytes exceeds the limit" };
+  }
+  size_t length{ 0 };
+  do {
+    byte b = static_cast<byte>(size & 0x7f);
+    size >>= 7;
+    header[length++] = size ? static_cast<byte>(b | 0x80) : b;
+  } while (size);
+  return length;
+}
+
+delimiter_framer::delimiter_framer(std::string delimiter, size_t max_size)
+    : delimiter_{ std::move(delimiter) }
+    , max_size_{ max_size } {
+  if (delimiter_.empty()) {
+    throw socket_exception{ "Frame delimiter must not be empty" };
+  }
+}
+
+size_t delimiter_framer::decode(std::string_view  data,
+                                std::string_view& payload,
+                                size_t            checked) const {
+  // a delimiter may have started in the last bytes already checked
+  size_t from = checked >= delimiter_.size() ? checked - delimiter_.size() + 1
+                                             : 0;
+  size_t end  = data.find(delimiter_, from);
+  if (end == std::string_view::npos) {
+    // everything but a partial delimiter at the end belongs to the payload
+    if (data.size() > max_size_ + delimiter_.size()) {
+      throw socket_exception{ "Frame exceeds the limit of "
+                              + std::to_string(max_size_) + " bytes" };
+    }
+    return 0;
+  }
+  if (end > max_size_) {
+    throw socket_exception{ "Frame exceeds the limit of "
+                            + std::to_string(max_size_) + " bytes" };
+  }
+  payload = data.substr(0, end);
+  return end + delimiter_.size();
+}
+
+size_t delimiter_framer::encode_header(size_t size, byte*) const {
+  if (size > max_size_) {
+    throw socket_exception{ "Frame exceeds the limit of "
+                            + std::to_string(max_size_) + " bytes" };
+  }
+  return 0;
+}
+
+std::string_view delimiter_framer::trailer() const {
+  return delimiter_;
+}
+} // namespace socketio
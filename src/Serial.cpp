@@ -1,17 +1,67 @@
 #include "Serial.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#endif
+
 namespace serialio {
+namespace {
+#ifdef _WIN32
+const HANDLE no_handle = nullptr;
+#else
+constexpr int no_handle = -1;
+#endif
+// initial read-ahead buffer size, has to be a power of two
+constexpr size_t ring_size = 4096;
+
+// read and write limits, the COMMTIMEOUTS on Windows
+constexpr int read_interval_timeout          = 50;
+constexpr int read_total_timeout_constant    = 50;
+constexpr int read_total_timeout_multiplier  = 50;
+constexpr int write_total_timeout_constant   = 50;
+constexpr int write_total_timeout_multiplier = 10;
+} // namespace
+
+#ifdef _WIN32
 serial_exception::serial_exception(DWORD info) noexcept
-    : msg_{ nullptr } {
+    : info_{ nullptr }
+    , msg_{} {
   FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM
                     | FORMAT_MESSAGE_IGNORE_INSERTS,
                 nullptr, info, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
                 (LPTSTR) &info_, 0, nullptr);
 }
 
-serial_exception::serial_exception(const char* msg) noexcept
-    : info_{ nullptr } {
-  msg_ = msg;
+#else
+serial_exception::serial_exception(int error) noexcept
+    : info_{ strerror(error) }
+    , msg_{} {
+}
+#endif
+
+serial_exception::serial_exception(const char* msg)
+    : info_{ nullptr }
+    , msg_{ msg } {
 }
 
 const char* serial_exception::getInfo() noexcept {
@@ -19,8 +69,8 @@ const char* serial_exception::getInfo() noexcept {
 }
 
 const char* serial_exception::what() const noexcept {
-  if (msg_) {
-    return msg_;
+  if (!msg_.empty()) {
+    return msg_.c_str();
   }
   if (info_) {
     return "Serial exception: see getInfo() for more";
@@ -28,75 +78,342 @@ const char* serial_exception::what() const noexcept {
   return "Serial exception";
 }
 
+/**
+ * @brief single producer, single consumer ring filled by a thread that keeps
+ * reading the port
+ * @note positions only grow and are masked into the buffers; every chunk
+ * read gets a record with its end position and arrival time
+ */
+struct serial::reader {
+  using clock = std::chrono::steady_clock;
+
+  struct chunk {
+    uint64_t          end;
+    clock::time_point received;
+  };
+
+  std::vector<byte>  data;
+  std::vector<chunk> chunks;
+  // consumer and producer positions on their own cache lines
+  alignas(64) std::atomic<uint64_t> head;
+  std::atomic<uint64_t>             chunkHead;
+  alignas(64) std::atomic<uint64_t> tail;
+  std::atomic<uint64_t>             chunkTail;
+
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint64_t> overflows;
+  std::atomic<bool>     stop;
+  std::atomic<bool>     finished;
+  std::exception_ptr    error;
+
+  // only for sleeping consumers, the ring itself takes no lock
+  std::atomic<int>        waiters;
+  std::mutex              mutex;
+  std::condition_variable wakeup;
+  std::thread             thread;
+
+  explicit reader(size_t capacity)
+      : data(capacity)
+      , chunks(std::max<size_t>(capacity / 64, 64))
+      , head{ 0 }
+      , chunkHead{ 0 }
+      , tail{ 0 }
+      , chunkTail{ 0 }
+      , dropped{ 0 }
+      , overflows{ 0 }
+      , stop{ false }
+      , finished{ false }
+      , error{}
+      , waiters{ 0 }
+      , mutex{}
+      , wakeup{}
+      , thread{} {
+  }
+
+  ~reader() {
+    stop = true;
+    if (thread.joinable())
+      thread.join();
+  }
+
+  size_t available() const {
+    return static_cast<size_t>(tail.load() - head.load());
+  }
+
+  void wake() {
+    if (waiters.load()) {
+      std::lock_guard<std::mutex> lock{ mutex };
+      wakeup.notify_all();
+    }
+  }
+
+  /**
+   * @brief copies what fits of a chunk that was read while the ring was
+   * full, counts the rest as dropped
+   * @return size_t bytes kept
+   */
+  size_t salvage(const byte* chunk, size_t size, bool& dropping) {
+    uint64_t end  = tail.load(std::memory_order_relaxed);
+    size_t   kept = std::min<size_t>(
+        size, data.size() - (end - head.load(std::memory_order_acquire)));
+    size_t mask  = data.size() - 1;
+    size_t first = std::min(kept, data.size() - (end & mask));
+    memcpy(data.data() + (end & mask), chunk, first);
+    memcpy(data.data(), chunk + first, kept - first);
+    if (kept < size) {
+      dropped += size - kept;
+      if (!dropping)
+        ++overflows;
+    }
+    dropping = kept < size;
+    return kept;
+  }
+
+  void run(serial& port) {
+    std::vector<byte> scratch(ring_size);
+    bool              dropping{ false };
+    bool              unrecorded{ false };
+    chunk             record{};
+    try {
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t end   = tail.load(std::memory_order_relaxed);
+        size_t   index = end & (data.size() - 1);
+        size_t   space = std::min<size_t>(
+            data.size() - (end - head.load(std::memory_order_acquire)),
+            data.size() - index);
+        // keep draining the port when the ring is full
+        unsigned long got
+            = space ? port.readChunk(data.data() + index, space)
+                    : port.readChunk(scratch.data(), scratch.size());
+        if (!space && got)
+          got = salvage(scratch.data(), got, dropping);
+        else if (got)
+          dropping = false;
+        if (!got)
+          continue;
+        if (!unrecorded) {
+          record.received = clock::now();
+          unrecorded      = true;
+        }
+        // with no free record the next one also covers these bytes
+        record.end         = end + got;
+        uint64_t chunkEnd  = chunkTail.load(std::memory_order_relaxed);
+        size_t   chunkMask = chunks.size() - 1;
+        if (chunkEnd - chunkHead.load(std::memory_order_acquire)
+            < chunks.size()) {
+          chunks[chunkEnd & chunkMask] = record;
+          chunkTail.store(chunkEnd + 1, std::memory_order_release);
+          unrecorded = false;
+        }
+        tail.store(end + got);
+        wake();
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    finished = true;
+    wake();
+  }
+
+  /**
+   * @brief waits until wanted bytes are buffered, the deadline passes or
+   * the thread ends, then takes up to bytes
+   * @note rethrows what ended the thread once the ring is empty
+   */
+  size_t read(byte* buffer, size_t bytes, size_t wanted,
+              clock::time_point deadline, clock::time_point* received) {
+    auto ready = [&] {
+      return finished.load() || available() >= wanted;
+    };
+    if (!ready()) {
+      ++waiters;
+      {
+        std::unique_lock<std::mutex> lock{ mutex };
+        wakeup.wait_until(lock, deadline, ready);
+      }
+      --waiters;
+    }
+
+    bool     ended = finished.load();
+    uint64_t start = head.load(std::memory_order_relaxed);
+    size_t   count = std::min<size_t>(bytes, tail.load() - start);
+    if (!count) {
+      if (ended && error)
+        std::rethrow_exception(error);
+      return 0;
+    }
+
+    size_t   mask      = data.size() - 1;
+    size_t   chunkMask = chunks.size() - 1;
+    uint64_t chunk     = chunkHead.load(std::memory_order_relaxed);
+    uint64_t chunkEnd  = chunkTail.load(std::memory_order_acquire);
+    if (received) {
+      while (chunk != chunkEnd && chunks[chunk & chunkMask].end <= start) {
+        ++chunk;
+      }
+      *received = chunk != chunkEnd ? chunks[chunk & chunkMask].received
+                                    : clock::now();
+    }
+    size_t first = std::min(count, data.size() - (start & mask));
+    memcpy(buffer, data.data() + (start & mask), first);
+    memcpy(buffer + first, data.data(), count - first);
+    head.store(start + count);
+    while (chunk != chunkEnd
+           && chunks[chunk & chunkMask].end <= start + count) {
+      ++chunk;
+    }
+    chunkHead.store(chunk, std::memory_order_release);
+    return count;
+  }
+};
+
 serial::serial(const serial_port& port, const Baud baud, const int byteSize,
                const StopBits stopBits, const Parity parity)
-    : serialHandle{ nullptr }
+    : serialHandle{ no_handle }
     , port_{ port }
     , baud_{ baud }
     , byteSize_{ byteSize }
     , stopBits_{ stopBits }
     , parity_{ parity }
-    , open_{ false } {
+    , open_{ false }
+    , ring_(ring_size)
+    , head_{ 0 }
+    , tail_{ 0 }
+    , delimiter_{ "\n" }
+    , keep_{}
+    , reader_{} {
+  setLineFilter([](byte b) { return b > 31 && b < 127; });
 }
 
 serial::~serial() {
-  if (open_)
-    close();
+  if (open_) {
+    // close() reports errors by throwing, which must not leave a destructor
+    try {
+      close();
+    } catch (...) {
+    }
+  }
+}
+
+bool serial::isOpen() const {
+  return open_;
+}
+
+#ifdef _WIN32
+namespace {
+/**
+ * @brief waits for an overlapped transfer, COMMTIMEOUTS bound it
+ *
+ * @param started what ReadFile() or WriteFile() returned
+ * @param[out] done bytes transferred
+ * @return true if successful
+ */
+bool transfer(HANDLE handle, OVERLAPPED& overlapped, BOOL started,
+              DWORD& done) {
+  if (!started && GetLastError() != ERROR_IO_PENDING)
+    return false;
+  return GetOverlappedResult(handle, &overlapped, &done, TRUE);
+}
+
+/**
+ * @brief event handle with the low bit set, blocking transfers do not post
+ * to the completion port of a serial_loop the handle is attached to
+ */
+HANDLE tagged(HANDLE event) {
+  return reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(event) | 1);
+}
+
+HANDLE untagged(HANDLE event) {
+  return reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(event)
+                                  & ~ULONG_PTR{ 1 });
 }
+} // namespace
 
 bool serial::open() {
   serialHandle = CreateFile((R"(\\.\)" + port_.name).c_str(),
                             GENERIC_READ | GENERIC_WRITE, 0, nullptr,
-                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+                            nullptr);
 
-  if (serialHandle == INVALID_HANDLE_VALUE)
-    if (GetLastError() == ERROR_FILE_NOT_FOUND)
+  if (serialHandle == INVALID_HANDLE_VALUE) {
+    DWORD error  = GetLastError();
+    serialHandle = no_handle;
+    if (error == ERROR_FILE_NOT_FOUND)
       throw serial_exception{ ("Port not found: " + port_.name).c_str() };
+    throw serial_exception{ error };
+  }
 
-  DCB serialParams;
-  SecureZeroMemory(&serialParams, sizeof(DCB));
-  serialParams.DCBlength = sizeof(DCB);
-
-  GetCommState(serialHandle, &serialParams);
-  serialParams.BaudRate    = baud_;
-  serialParams.ByteSize    = byteSize_;
-  serialParams.StopBits    = stopBits_;
-  serialParams.Parity      = parity_;
-  serialParams.fRtsControl = RTS_CONTROL_DISABLE;
-  serialParams.fDtrControl = DTR_CONTROL_DISABLE;
-  if (!SetCommState(serialHandle, &serialParams))
-    throw serial_exception{ GetLastError() };
+  HANDLE readEvent{ nullptr };
+  HANDLE writeEvent{ nullptr };
+  try {
+    DCB serialParams;
+    SecureZeroMemory(&serialParams, sizeof(DCB));
+    serialParams.DCBlength = sizeof(DCB);
 
-  COMMTIMEOUTS timeout                = { 0 };
-  timeout.ReadIntervalTimeout         = 50;
-  timeout.ReadTotalTimeoutConstant    = 50;
-  timeout.ReadTotalTimeoutMultiplier  = 50;
-  timeout.WriteTotalTimeoutConstant   = 50;
-  timeout.WriteTotalTimeoutMultiplier = 10;
-  if (!SetCommTimeouts(serialHandle, &timeout))
-    throw serial_exception{ GetLastError() };
+    GetCommState(serialHandle, &serialParams);
+    serialParams.BaudRate    = baud_;
+    serialParams.ByteSize    = byteSize_;
+    serialParams.StopBits    = stopBits_;
+    serialParams.Parity      = parity_;
+    serialParams.fRtsControl = RTS_CONTROL_DISABLE;
+    serialParams.fDtrControl = DTR_CONTROL_DISABLE;
+    if (!SetCommState(serialHandle, &serialParams))
+      throw serial_exception{ GetLastError() };
 
-  if (!GetCommState(serialHandle, &serialParams))
-    throw serial_exception{ GetLastError() };
+    COMMTIMEOUTS timeout                = { 0 };
+    timeout.ReadIntervalTimeout         = read_interval_timeout;
+    timeout.ReadTotalTimeoutConstant    = read_total_timeout_constant;
+    timeout.ReadTotalTimeoutMultiplier  = read_total_timeout_multiplier;
+    timeout.WriteTotalTimeoutConstant   = write_total_timeout_constant;
+    timeout.WriteTotalTimeoutMultiplier = write_total_timeout_multiplier;
+    if (!SetCommTimeouts(serialHandle, &timeout))
+      throw serial_exception{ GetLastError() };
+
+    if (!GetCommState(serialHandle, &serialParams))
+      throw serial_exception{ GetLastError() };
+
+    readEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!readEvent)
+      throw serial_exception{ GetLastError() };
+    writeEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!writeEvent)
+      throw serial_exception{ GetLastError() };
+  } catch (...) {
+    if (readEvent)
+      CloseHandle(readEvent);
+    CloseHandle(serialHandle);
+    serialHandle = no_handle;
+    open_        = false;
+    throw;
+  }
+  readOverlapped_         = {};
+  writeOverlapped_        = {};
+  readOverlapped_.hEvent  = tagged(readEvent);
+  writeOverlapped_.hEvent = tagged(writeEvent);
 
   open_ = true;
   return true;
 }
 
 bool serial::close() {
+  stopReader();
   setDTR(false);
   setRTS(false);
   FindClose(serialHandle);
-  if (!CloseHandle(serialHandle))
-    throw serial_exception{ GetLastError() };
-  open_ = false;
+  BOOL  closed = CloseHandle(serialHandle);
+  DWORD error  = GetLastError();
+  CloseHandle(untagged(readOverlapped_.hEvent));
+  CloseHandle(untagged(writeOverlapped_.hEvent));
+  serialHandle = no_handle;
+  open_        = false;
+  head_ = tail_ = 0;
+  // the handle is gone either way, so the port counts as closed
+  if (!closed)
+    throw serial_exception{ error };
   return true;
 }
 
-bool serial::isOpen() const {
-  return open_;
-}
-
 void serial::setDTR(bool dtr) {
   EscapeCommFunction(serialHandle, dtr ? SETDTR : CLRDTR);
 }
@@ -117,82 +434,636 @@ bool serial::isCTS() const {
   return modemStat & MS_CTS_ON;
 }
 
-void serial::waitFor(Event event) const {
-  WaitCommEvent(this->serialHandle, (LPDWORD) &event, NULL);
+unsigned int serial::waitFor(unsigned int events) {
+  if (!SetCommMask(this->serialHandle, events))
+    throw serial_exception{ GetLastError() };
+  OVERLAPPED overlapped{};
+  HANDLE     event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (!event)
+    throw serial_exception{ GetLastError() };
+  overlapped.hEvent = tagged(event);
+  DWORD occurred{ 0 };
+  DWORD done{ 0 };
+  bool  ok = transfer(this->serialHandle, overlapped,
+                      WaitCommEvent(this->serialHandle, &occurred, &overlapped),
+                      done);
+  DWORD error = GetLastError();
+  CloseHandle(event);
+  if (!ok)
+    throw serial_exception{ error };
+  return occurred;
 }
 
-unsigned long serial::read(byte buffer[], unsigned int bytes) {
-  OVERLAPPED osReader{ 0 };
-  DWORD      read{ 0 };
-  bool       waitingOnRead{ false };
+unsigned long serial::readSome(byte buffer[], unsigned int bytes) {
+  DWORD read{ 0 };
+  BOOL  started = ReadFile(this->serialHandle, buffer, bytes, nullptr,
+                           &readOverlapped_);
+  if (!transfer(this->serialHandle, readOverlapped_, started, read))
+    return 0;
+  return read;
+}
+
+unsigned long serial::readChunk(byte buffer[], size_t bytes) {
+  COMSTAT comStat;
+  ClearCommError(this->serialHandle, nullptr, &comStat);
+  // everything that is there, or wait for the first byte
+  DWORD wanted = static_cast<DWORD>(
+      std::clamp<size_t>(comStat.cbInQue, 1, bytes));
+  DWORD read{ 0 };
+  BOOL  started = ReadFile(this->serialHandle, buffer, wanted, nullptr,
+                           &readOverlapped_);
+  if (!transfer(this->serialHandle, readOverlapped_, started, read))
+    throw serial_exception{ GetLastError() };
+  return read;
+}
+
+bool serial::write(byte buffer[], unsigned int bytes) {
+  // bounded by the write COMMTIMEOUTS instead of waiting forever
+  DWORD written{ 0 };
+  BOOL  started = WriteFile(this->serialHandle, buffer, bytes, nullptr,
+                            &writeOverlapped_);
+  return transfer(this->serialHandle, writeOverlapped_, started, written)
+         && written == bytes;
+}
+
+unsigned int serial::dataAvailable() {
+  if (reader_)
+    return static_cast<unsigned int>(tail_ - head_ + reader_->available());
+  COMSTAT comStat;
+  ClearCommError(this->serialHandle, nullptr, &comStat);
+  return static_cast<unsigned int>(tail_ - head_) + comStat.cbInQue;
+}
+
+std::vector<serial_port> serial::getAvailablePorts() {
+  std::vector<serial_port> ports{};
+
+  char portPath[1000];
+  for (int i = 0; i < 255; ++i) {
+    if (QueryDosDevice(("COM" + std::to_string(i)).c_str(), portPath,
+                       sizeof(portPath))) {
+      ports.push_back(i);
+    }
+  }
+  return ports;
+}
+
+#else
+namespace {
+speed_t to_speed(Baud baud) {
+  switch (baud) {
+    case BD_110:
+      return B110;
+    case BD_300:
+      return B300;
+    case BD_600:
+      return B600;
+    case BD_1200:
+      return B1200;
+    case BD_2400:
+      return B2400;
+    case BD_4800:
+      return B4800;
+    case BD_9600:
+      return B9600;
+    case BD_19200:
+      return B19200;
+    case BD_38400:
+      return B38400;
+    case BD_57600:
+      return B57600;
+    case BD_115200:
+      return B115200;
+    case BD_230400:
+      return B230400;
+#ifdef B460800
+    case BD_460800:
+      return B460800;
+#endif
+#ifdef B921600
+    case BD_921600:
+      return B921600;
+#endif
+    default:
+      throw serial_exception{ "Baud rate not supported by termios" };
+  }
+}
+
+/**
+ * @brief milliseconds left of timeout_ms since start
+ *
+ */
+int time_left(int timeout_ms, std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  return elapsed >= timeout_ms ? 0 : timeout_ms - static_cast<int>(elapsed);
+}
+
+/**
+ * @brief waits for events on fd
+ *
+ * @return short returned events, 0 on timeout
+ */
+short wait_for(int fd, short events, int timeout_ms) {
+  pollfd pfd{};
+  pfd.fd     = fd;
+  pfd.events = events;
+  while (true) {
+    int ready = ::poll(&pfd, 1, timeout_ms);
+    if (ready > 0)
+      return pfd.revents;
+    if (ready == 0)
+      return 0;
+    if (errno != EINTR)
+      throw serial_exception{ errno };
+  }
+}
+
+void set_modem_line(int fd, int line, bool set) {
+  if (ioctl(fd, set ? TIOCMBIS : TIOCMBIC, &line) == -1)
+    throw serial_exception{ errno };
+}
+
+/**
+ * @brief pseudo terminals have no modem lines
+ *
+ */
+bool has_modem_lines(int fd) {
+  int lines{ 0 };
+  return ioctl(fd, TIOCMGET, &lines) != -1;
+}
+
+int modem_lines(int fd) {
+  int lines{ 0 };
+  if (ioctl(fd, TIOCMGET, &lines) == -1)
+    throw serial_exception{ errno };
+  return lines;
+}
+} // namespace
+
+bool serial::open() {
+  serialHandle = ::open(port_.name.c_str(),
+                        O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (serialHandle == -1) {
+    if (errno == ENOENT)
+      throw serial_exception{ ("Port not found: " + port_.name).c_str() };
+    throw serial_exception{ errno };
+  }
+
+  termios serialParams{};
+  if (tcgetattr(serialHandle, &serialParams) == -1) {
+    int error = errno;
+    ::close(serialHandle);
+    throw serial_exception{ error };
+  }
+  cfmakeraw(&serialParams);
+  serialParams.c_cflag |= CLOCAL | CREAD;
+  serialParams.c_cflag &= ~(CSIZE | CSTOPB | PARENB | PARODD | CRTSCTS);
+  switch (byteSize_) {
+    case 5:
+      serialParams.c_cflag |= CS5;
+      break;
+    case 6:
+      serialParams.c_cflag |= CS6;
+      break;
+    case 7:
+      serialParams.c_cflag |= CS7;
+      break;
+    default:
+      serialParams.c_cflag |= CS8;
+      break;
+  }
+  // termios knows one and two stop bits, 1.5 is what CSTOPB gives for 5 bit
+  // bytes
+  if (stopBits_ == BITS_15 || stopBits_ == BITS_20)
+    serialParams.c_cflag |= CSTOPB;
+  switch (parity_) {
+    case NO_PRT:
+      break;
+    case ODD_PRT:
+      serialParams.c_cflag |= PARENB | PARODD;
+      break;
+    case EVEN_PRT:
+      serialParams.c_cflag |= PARENB;
+      break;
+#ifdef CMSPAR
+    case MARK_PRT:
+      serialParams.c_cflag |= PARENB | CMSPAR | PARODD;
+      break;
+    case SPACE_PRT:
+      serialParams.c_cflag |= PARENB | CMSPAR;
+      break;
+#endif
+    default:
+      ::close(serialHandle);
+      throw serial_exception{ "Parity not supported by termios" };
+  }
+  // reads are bounded with poll, not VMIN/VTIME
+  serialParams.c_cc[VMIN]  = 0;
+  serialParams.c_cc[VTIME] = 0;
+  try {
+    speed_t speed = to_speed(baud_);
+    if (cfsetispeed(&serialParams, speed) == -1
+        || cfsetospeed(&serialParams, speed) == -1
+        || tcsetattr(serialHandle, TCSANOW, &serialParams) == -1)
+      throw serial_exception{ errno };
+    open_ = true;
+    if (has_modem_lines(serialHandle)) {
+      setDTR(false);
+      setRTS(false);
+    }
+  } catch (...) {
+    ::close(serialHandle);
+    open_ = false;
+    throw;
+  }
+  return true;
+}
+
+bool serial::close() {
+  stopReader();
+  try {
+    if (has_modem_lines(serialHandle)) {
+      setDTR(false);
+      setRTS(false);
+    }
+  } catch (const serial_exception&) {
+    // e.g. an unplugged adapter, the descriptor is closed anyway
+  }
+  int result   = ::close(serialHandle);
+  int error    = errno;
+  serialHandle = no_handle;
+  open_        = false;
+  head_ = tail_ = 0;
+  // the descriptor is released even if close() fails
+  if (result == -1)
+    throw serial_exception{ error };
+  return true;
+}
+
+void serial::setDTR(bool dtr) {
+  set_modem_line(serialHandle, TIOCM_DTR, dtr);
+}
+
+void serial::setRTS(bool rts) {
+  set_modem_line(serialHandle, TIOCM_RTS, rts);
+}
+
+bool serial::isDSR() const {
+  return modem_lines(serialHandle) & TIOCM_DSR;
+}
+
+bool serial::isCTS() const {
+  return modem_lines(serialHandle) & TIOCM_CTS;
+}
 
-  osReader.hEvent = CreateEvent(nullptr, true, false, nullptr);
-  if (osReader.hEvent == NULL)
+unsigned int serial::sampleLines() {
+  unsigned int events{ 0 };
+#ifdef __linux__
+  // counters also catch changes that are gone again by the next sample
+  serial_icounter_struct counts{};
+  if (ioctl(serialHandle, TIOCGICOUNT, &counts) == 0) {
+    constexpr Event    kinds[] = { CTS_CHANGED, DSR_CHANGED, RLSD_CHANGED,
+                                   RING,        BREAK,       ERR };
+    std::array<int, 6> now{ counts.cts,
+                            counts.dsr,
+                            counts.dcd,
+                            counts.rng,
+                            counts.brk,
+                            counts.frame + counts.overrun + counts.parity
+                                + counts.buf_overrun };
+    for (size_t i = 0; i < now.size(); ++i) {
+      if (now[i] != lineCounts_[i])
+        events |= kinds[i];
+    }
+    lineCounts_ = now;
+    return events;
+  }
+#endif
+  int lines{ 0 };
+  if (ioctl(serialHandle, TIOCMGET, &lines) == -1)
     return 0;
-  if (!waitingOnRead) {
-    if (!ReadFile(this->serialHandle, buffer, bytes, &read, &osReader)) {
-      if (GetLastError() != ERROR_IO_PENDING) {
-      } else {
-        waitingOnRead = true;
-      }
-    } else {
-      CloseHandle(osReader.hEvent);
-      return read;
+  int changed = lines ^ modemLines_;
+  modemLines_ = lines;
+  if (changed & TIOCM_CTS)
+    events |= CTS_CHANGED;
+  if (changed & TIOCM_DSR)
+    events |= DSR_CHANGED;
+  if (changed & TIOCM_CD)
+    events |= RLSD_CHANGED;
+  if (changed & TIOCM_RNG)
+    events |= RING;
+  return events;
+}
+
+unsigned int serial::waitFor(unsigned int events) {
+  sampleLines();
+  while (true) {
+    unsigned int occurred = sampleLines() & events;
+    if ((events & CHAR_REVEIVED)
+        && (head_ != tail_ || (reader_ && reader_->available())
+            || (wait_for(serialHandle, POLLIN, 0) & POLLIN)))
+      occurred |= CHAR_REVEIVED;
+    int queued{ 0 };
+    if ((events & OUTPUT_EMPTY) && ioctl(serialHandle, TIOCOUTQ, &queued) == 0
+        && !queued)
+      occurred |= OUTPUT_EMPTY;
+    if (occurred)
+      return occurred;
+    wait_for(serialHandle, (events & CHAR_REVEIVED) && !reader_ ? POLLIN : 0,
+             lineSampleInterval);
+  }
+}
+
+unsigned long serial::readSome(byte buffer[], unsigned int bytes) {
+  auto          start = std::chrono::steady_clock::now();
+  int           total = read_total_timeout_constant
+                + read_total_timeout_multiplier * static_cast<int>(bytes);
+  unsigned long read{ 0 };
+  while (read < bytes) {
+    int timeout = time_left(total, start);
+    if (read)
+      timeout = std::min(timeout, read_interval_timeout);
+    if (!wait_for(serialHandle, POLLIN, timeout))
+      break;
+    ssize_t got = ::read(serialHandle, buffer + read, bytes - read);
+    if (got > 0) {
+      read += static_cast<unsigned long>(got);
+    } else if (got == 0 || errno == EIO) {
+      break; // the other side of a pseudo terminal went away
+    } else if (errno != EAGAIN && errno != EINTR) {
+      throw serial_exception{ errno };
     }
   }
-  CloseHandle(osReader.hEvent);
   return read;
 }
 
+unsigned long serial::readChunk(byte buffer[], size_t bytes) {
+  if (!wait_for(serialHandle, POLLIN, read_total_timeout_constant))
+    return 0;
+  while (true) {
+    // everything that is there with one call
+    ssize_t got = ::read(serialHandle, buffer, bytes);
+    if (got > 0)
+      return static_cast<unsigned long>(got);
+    if (got == 0 || errno == EIO)
+      throw serial_exception{ ("Port closed: " + port_.name).c_str() };
+    if (errno == EAGAIN)
+      return 0;
+    if (errno != EINTR)
+      throw serial_exception{ errno };
+  }
+}
+
+bool serial::write(byte buffer[], unsigned int bytes) {
+  auto         start = std::chrono::steady_clock::now();
+  int          total = write_total_timeout_constant
+                + write_total_timeout_multiplier * static_cast<int>(bytes);
+  unsigned int written{ 0 };
+  while (written < bytes) {
+    ssize_t sent = ::write(serialHandle, buffer + written, bytes - written);
+    if (sent > 0) {
+      written += static_cast<unsigned int>(sent);
+      continue;
+    }
+    if (sent == -1 && errno == EINTR)
+      continue;
+    if (sent == -1 && errno != EAGAIN)
+      return false;
+    if (!(wait_for(serialHandle, POLLOUT, time_left(total, start)) & POLLOUT))
+      return false;
+  }
+  return true;
+}
+
+unsigned int serial::dataAvailable() {
+  if (reader_)
+    return static_cast<unsigned int>(tail_ - head_ + reader_->available());
+  int available{ 0 };
+  if (ioctl(serialHandle, FIONREAD, &available) == -1)
+    throw serial_exception{ errno };
+  return static_cast<unsigned int>(tail_ - head_)
+         + static_cast<unsigned int>(available);
+}
+
+std::vector<serial_port> serial::getAvailablePorts() {
+  std::vector<serial_port> ports{};
+  std::error_code          error{};
+#ifdef __linux__
+  // only ttys backed by a device, not the virtual consoles
+  for (const auto& entry :
+       std::filesystem::directory_iterator{ "/sys/class/tty", error }) {
+    if (std::filesystem::exists(entry.path() / "device", error))
+      ports.push_back("/dev/" + entry.path().filename().string());
+  }
+#else
+  for (const auto& entry :
+       std::filesystem::directory_iterator{ "/dev", error }) {
+    if (entry.path().filename().string().rfind("cu.", 0) == 0)
+      ports.push_back(entry.path().string());
+  }
+#endif
+  return ports;
+}
+#endif
+
+unsigned long serial::read(byte buffer[], unsigned int bytes) {
+  if (head_ == tail_ && reader_) {
+    // same limits as a read from the port: the total timeout for the first
+    // byte, then until the line stays quiet for the interval timeout
+    using clock   = std::chrono::steady_clock;
+    auto deadline = clock::now()
+                    + std::chrono::milliseconds{
+                        read_total_timeout_constant
+                        + read_total_timeout_multiplier
+                              * static_cast<long long>(bytes) };
+    unsigned long read{ 0 };
+    while (read < bytes) {
+      auto until = deadline;
+      if (read) {
+        until = std::min(until, clock::now()
+                                    + std::chrono::milliseconds{
+                                        read_interval_timeout });
+      }
+      size_t got = reader_->read(buffer + read, bytes - read, 1, until,
+                                 nullptr);
+      if (!got)
+        break;
+      read += static_cast<unsigned long>(got);
+    }
+    return read;
+  }
+  if (head_ == tail_)
+    return readSome(buffer, bytes);
+  // bytes readLine() read ahead come first
+  size_t mask  = ring_.size() - 1;
+  size_t count = std::min<size_t>(bytes, tail_ - head_);
+  size_t first = std::min(count, ring_.size() - (head_ & mask));
+  memcpy(buffer, ring_.data() + (head_ & mask), first);
+  memcpy(buffer + first, ring_.data(), count - first);
+  head_ += count;
+  return count;
+}
+
 byte serial::read() {
-  byte buffer[1];
+  byte buffer[1]{};
   read(buffer, 1);
   return buffer[0];
 }
 
 std::string serial::readLine() {
-  std::string out{};
-  byte        b{};
-  while (b != '\n') {
-    b = read();
-    if (b > 31 && b < 127)
-      out.push_back(b);
+  size_t scanned{ 0 };
+  while (true) {
+    size_t length = findDelimiter(scanned);
+    if (length != std::string::npos) {
+      std::string out{};
+      out.reserve(length);
+      size_t mask = ring_.size() - 1;
+      for (size_t i = head_; i < head_ + length; ++i) {
+        byte b = ring_[i & mask];
+        if (keep_[b])
+          out.push_back(static_cast<char>(b));
+      }
+      head_ += length + delimiter_.size();
+      return out;
+    }
+    // a delimiter may start in the bytes that are already scanned
+    size_t buffered = tail_ - head_;
+    scanned = buffered >= delimiter_.size() ? buffered - delimiter_.size() + 1
+                                            : 0;
+    fill();
   }
-  return out;
 }
 
-bool serial::write(byte buffer[], unsigned int bytes) {
-  OVERLAPPED osWrite{ 0 };
-  DWORD      written{ 0 };
-  bool       successful{ false };
+unsigned long serial::fill() {
+  size_t        space{ 0 };
+  byte*         dst = ringSpace(space);
+  unsigned long got{ 0 };
+  if (reader_) {
+    got = reader_->read(dst, space, 1,
+                        std::chrono::steady_clock::now()
+                            + std::chrono::milliseconds{
+                                read_total_timeout_constant },
+                        nullptr);
+  } else {
+    got = readChunk(dst, space);
+  }
+  tail_ += got;
+  return got;
+}
 
-  osWrite.hEvent = CreateEvent(nullptr, true, false, nullptr);
-  if (osWrite.hEvent == NULL) {
-    return false;
+void serial::startReader(size_t capacity) {
+  if (!open_)
+    throw serial_exception{ "Port not open" };
+  if (reader_)
+    return;
+  reader_ = std::make_unique<reader>(
+      std::bit_ceil(std::max<size_t>(capacity, ring_size)));
+  reader* r = reader_.get();
+  r->thread = std::thread{ [this, r] { r->run(*this); } };
+}
+
+void serial::stopReader() {
+  if (!reader_)
+    return;
+  reader_->stop = true;
+  reader_->thread.join();
+  // keep what the thread buffered for the next reads
+  while (reader_->available()) {
+    size_t space{ 0 };
+    byte*  dst = ringSpace(space);
+    tail_ += reader_->read(dst, space, 0, {}, nullptr);
   }
-  if (!WriteFile(this->serialHandle, buffer, bytes, &written, &osWrite)) {
-    if (GetLastError() != ERROR_IO_PENDING) {
-      successful = false;
-    } else {
-      switch (WaitForSingleObject(osWrite.hEvent, INFINITE)) {
-        case WAIT_OBJECT_0:
-          if (!GetOverlappedResult(this->serialHandle, &osWrite, &written,
-                                   false)) {
-            successful = false;
-          } else {
-            successful = true;
-          }
-          break;
-        default:
-          successful = false;
-          break;
-      }
+  reader_.reset();
+}
+
+bool serial::isReaderRunning() const {
+  return reader_ != nullptr;
+}
+
+unsigned long serial::tryRead(byte buffer[], unsigned int bytes,
+                              std::chrono::steady_clock::time_point* received) {
+  return read(buffer, bytes, 0, received);
+}
+
+unsigned long serial::read(byte buffer[], unsigned int bytes, int timeoutMs,
+                           std::chrono::steady_clock::time_point* received) {
+  if (!reader_)
+    throw serial_exception{ "Reader thread not running" };
+  if (head_ != tail_) {
+    // read ahead by readLine(), the arrival time is gone
+    if (received)
+      *received = std::chrono::steady_clock::now();
+    return read(buffer, bytes);
+  }
+  return reader_->read(buffer, bytes, timeoutMs > 0 ? 1 : 0,
+                       std::chrono::steady_clock::now()
+                           + std::chrono::milliseconds{ timeoutMs },
+                       received);
+}
+
+unsigned long long serial::droppedBytes() const {
+  return reader_ ? reader_->dropped.load() : 0;
+}
+
+unsigned long long serial::overflows() const {
+  return reader_ ? reader_->overflows.load() : 0;
+}
+
+void serial::setDelimiter(const std::string& delimiter) {
+  if (delimiter.empty())
+    throw serial_exception{ "Delimiter must not be empty" };
+  delimiter_ = delimiter;
+}
+
+void serial::setLineFilter(const std::function<bool(byte)>& keep) {
+  for (size_t b = 0; b < keep_.size(); ++b) {
+    keep_[b] = !keep || keep(static_cast<byte>(b));
+  }
+}
+
+size_t serial::findDelimiter(size_t from) const {
+  size_t mask     = ring_.size() - 1;
+  size_t buffered = tail_ - head_;
+  byte   last     = static_cast<byte>(delimiter_.back());
+  // look for the last delimiter byte with memchr, then check the rest
+  for (size_t pos = from + delimiter_.size() - 1; pos < buffered;) {
+    size_t      index = (head_ + pos) & mask;
+    size_t      chunk = std::min(buffered - pos, ring_.size() - index);
+    const void* hit   = memchr(ring_.data() + index, last, chunk);
+    if (!hit) {
+      pos += chunk;
+      continue;
     }
-  } else {
-    successful = true;
+    pos += static_cast<size_t>(static_cast<const byte*>(hit)
+                               - (ring_.data() + index));
+    size_t start = pos + 1 - delimiter_.size();
+    bool   match = true;
+    for (size_t i = 0; i + 1 < delimiter_.size() && match; ++i) {
+      match = ring_[(head_ + start + i) & mask]
+              == static_cast<byte>(delimiter_[i]);
+    }
+    if (match)
+      return start;
+    ++pos;
+  }
+  return std::string::npos;
+}
+
+byte* serial::ringSpace(size_t& space) {
+  size_t buffered = tail_ - head_;
+  if (buffered == ring_.size()) {
+    // a line longer than the buffer, unwrap into one twice the size
+    std::vector<byte> grown(ring_.size() * 2);
+    read(grown.data(), static_cast<unsigned int>(buffered));
+    ring_ = std::move(grown);
+    head_ = 0;
+    tail_ = buffered;
   }
-  CloseHandle(osWrite.hEvent);
-  return successful;
+  size_t mask  = ring_.size() - 1;
+  size_t index = tail_ & mask;
+  space = std::min(ring_.size() - buffered, ring_.size() - index);
+  return ring_.data() + index;
 }
 
 void serial::write(byte b) {
@@ -207,24 +1078,6 @@ void serial::writeLine(const std::string& s) {
   write(s + '\n');
 }
 
-unsigned int serial::dataAvailable() {
-  COMSTAT comStat;
-  ClearCommError(this->serialHandle, nullptr, &comStat);
-  return comStat.cbInQue;
-}
-
-std::vector<serial_port> serial::getAvailablePorts() {
-  std::vector<serial_port> ports{};
-
-  char portPath[1000];
-  for (int i = 0; i < 255; ++i) {
-    if (QueryDosDevice(("COM" + std::to_string(i)).c_str(), portPath, 5000)) {
-      ports.push_back(i);
-    }
-  }
-  return ports;
-}
-
 /*
 void serial::operator<<(const char *c) { this->write(c); }
 
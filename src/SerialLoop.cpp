@@ -0,0 +1,622 @@
+#include "SerialLoop.hpp"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <cerrno>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#endif
+
+namespace {
+// most bytes one read hands over
+constexpr size_t read_chunk = 4096;
+// most completions or readiness events taken per round
+constexpr int max_events = 64;
+
+constexpr unsigned int line_events = serialio::CTS_CHANGED
+                                   | serialio::DSR_CHANGED
+                                   | serialio::RLSD_CHANGED
+                                   | serialio::RING | serialio::BREAK
+                                   | serialio::ERR;
+} // namespace
+
+namespace serialio {
+serial_loop::channel::channel(serial& port)
+    : port{ &port }
+    , in(read_chunk)
+    , onRead{}
+    , out{}
+    , flight{}
+    , flightSent{ 0 }
+    , queued{ 0 }
+    , sent{ 0 }
+    , onWritten{}
+    , watched{ 0 }
+    , onEvent{} {
+#ifdef _WIN32
+  handle     = INVALID_HANDLE_VALUE;
+  readOp     = {};
+  writeOp    = {};
+  waitOp     = {};
+  occurred   = 0;
+  commMask   = 0;
+  checkQueue = true;
+  failed     = false;
+  for (operation* op : { &readOp, &writeOp, &waitOp }) {
+    op->owner = this;
+  }
+#else
+  revents = 0;
+#ifdef __linux__
+  armed      = 0;
+  registered = false;
+#endif
+#endif
+}
+
+#ifdef _WIN32
+bool serial_loop::channel::inflight() const {
+  return readOp.pending || writeOp.pending || waitOp.pending;
+}
+#endif
+
+serial_loop::serial_loop()
+    : channels_{}
+    , tasks_{}
+    , tasksMutex_{}
+    , stopped_{ false } {
+#ifdef _WIN32
+  completionPort_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+  if (!completionPort_)
+    throw serial_exception{ GetLastError() };
+#else
+  if (pipe(wakePipe_) == -1)
+    throw serial_exception{ errno };
+  for (int fd : wakePipe_) {
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+#ifdef __linux__
+  epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd_ == -1) {
+    int error = errno;
+    ::close(wakePipe_[0]);
+    ::close(wakePipe_[1]);
+    throw serial_exception{ error };
+  }
+  // the wake pipe is the one entry without a channel
+  epoll_event ev{};
+  ev.events   = EPOLLIN;
+  ev.data.ptr = nullptr;
+  epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakePipe_[0], &ev);
+#endif
+#endif
+}
+
+serial_loop::~serial_loop() {
+#ifdef _WIN32
+  while (!channels_.empty()) {
+    cancel(*channels_.begin()->first);
+  }
+  // cancelled transfers still post their completion
+  while (!detached_.empty()) {
+    OVERLAPPED_ENTRY entries[max_events];
+    ULONG            count{ 0 };
+    if (!GetQueuedCompletionStatusEx(completionPort_, entries, max_events,
+                                     &count, INFINITE, FALSE))
+      break;
+    for (ULONG i = 0; i < count; ++i) {
+      if (entries[i].lpOverlapped)
+        static_cast<channel::operation*>(entries[i].lpOverlapped)->pending
+            = false;
+    }
+    std::erase_if(detached_, [](const std::shared_ptr<channel>& ch) {
+      return !ch->inflight();
+    });
+  }
+  CloseHandle(completionPort_);
+#else
+  channels_.clear();
+#ifdef __linux__
+  ::close(epollFd_);
+#endif
+  ::close(wakePipe_[0]);
+  ::close(wakePipe_[1]);
+#endif
+}
+
+serial_loop::channel& serial_loop::attach(serial& port) {
+  auto it = channels_.find(&port);
+  if (it != channels_.end())
+    return *it->second;
+  if (!port.isOpen())
+    throw serial_exception{ "Port not open" };
+  auto ch = std::make_shared<channel>(port);
+#ifdef _WIN32
+  ch->handle = port.serialHandle;
+  // a handle stays with the first completion port it was associated with
+  if (!CreateIoCompletionPort(ch->handle, completionPort_, 0, 0)
+      && GetLastError() != ERROR_INVALID_PARAMETER)
+    throw serial_exception{ GetLastError() };
+#endif
+  return *channels_.emplace(&port, std::move(ch)).first->second;
+}
+
+bool serial_loop::attached(const std::shared_ptr<channel>& ch) const {
+  auto it = channels_.find(ch->port);
+  return it != channels_.end() && it->second == ch;
+}
+
+void serial_loop::asyncRead(serial& port, read_handler h) {
+  if (port.isReaderRunning())
+    throw serial_exception{ "Port has a reader thread" };
+  channel& ch = attach(port);
+  if (ch.onRead)
+    throw serial_exception{ "Read already pending" };
+  ch.onRead = std::move(h);
+}
+
+void serial_loop::asyncWrite(serial& port, const byte buffer[],
+                             unsigned int bytes, write_handler h) {
+  channel& ch = attach(port);
+  ch.out.insert(ch.out.end(), buffer, buffer + bytes);
+  ch.queued += bytes;
+  ch.onWritten.emplace_back(ch.queued, std::move(h));
+}
+
+void serial_loop::asyncWrite(serial& port, const std::string& s,
+                             write_handler h) {
+  asyncWrite(port, reinterpret_cast<const byte*>(s.data()),
+             static_cast<unsigned int>(s.size()), std::move(h));
+}
+
+void serial_loop::watch(serial& port, unsigned int events, event_handler h) {
+  channel& ch = attach(port);
+  ch.watched  = h ? events & line_events : 0;
+  ch.onEvent  = std::move(h);
+#ifndef _WIN32
+  // changes from before are not reported
+  port.sampleLines();
+#endif
+}
+
+void serial_loop::cancel(serial& port) {
+  auto it = channels_.find(&port);
+  if (it == channels_.end())
+    return;
+  // a running dispatch keeps the channel until it returns
+  std::shared_ptr<channel> ch = it->second;
+  channels_.erase(it);
+#ifdef _WIN32
+  if (ch->commMask)
+    SetCommMask(ch->handle, 0);
+  for (channel::operation* op : { &ch->readOp, &ch->writeOp, &ch->waitOp }) {
+    if (op->pending)
+      CancelIoEx(ch->handle, op);
+  }
+  if (ch->inflight())
+    detached_.push_back(std::move(ch));
+#elif defined(__linux__)
+  // fails harmlessly if the port has already been closed
+  if (ch->registered)
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, port.serialHandle, nullptr);
+#endif
+}
+
+void serial_loop::completeRead(channel& ch, unsigned long size) {
+  read_handler h = std::move(ch.onRead);
+  ch.onRead      = nullptr;
+  h(ch.in.data(), size);
+}
+
+bool serial_loop::completeWrites(channel& ch, bool failed) {
+  if (failed) {
+    ch.out.clear();
+    ch.flight.clear();
+    ch.flightSent = 0;
+    ch.sent       = ch.queued;
+  }
+  // handlers may queue more, so take the due ones first
+  std::vector<write_handler> done{};
+  while (!ch.onWritten.empty() && ch.onWritten.front().first <= ch.sent) {
+    done.push_back(std::move(ch.onWritten.front().second));
+    ch.onWritten.pop_front();
+  }
+  for (auto& h : done) {
+    if (h)
+      h(!failed);
+  }
+  return !done.empty();
+}
+
+bool serial_loop::nextFlight(channel& ch) {
+  if (ch.flightSent < ch.flight.size())
+    return true;
+  ch.flight.clear();
+  ch.flightSent = 0;
+  if (ch.out.empty())
+    return false;
+  // the buffer in flight stays put while asyncWrite() appends to the other
+  std::swap(ch.flight, ch.out);
+  return true;
+}
+
+#ifdef _WIN32
+bool serial_loop::prepare(channel& ch) {
+  auto start = [](channel::operation& op, BOOL started) {
+    // completions are posted even for transfers that finish right away
+    if (started || GetLastError() == ERROR_IO_PENDING) {
+      op.pending = true;
+    } else {
+      op.done = true;
+      op.ok   = false;
+    }
+  };
+  if (ch.failed)
+    return ch.onRead || !ch.onWritten.empty();
+
+  DWORD mask = (ch.onRead ? EV_RXCHAR : 0) | ch.watched;
+  if (mask != ch.commMask) {
+    // completes a pending WaitCommEvent()
+    SetCommMask(ch.handle, mask);
+    ch.commMask = mask;
+  }
+  if (mask && !ch.waitOp.pending && !ch.waitOp.done) {
+    ch.occurred = 0;
+    start(ch.waitOp, WaitCommEvent(ch.handle, &ch.occurred, &ch.waitOp));
+  }
+
+  bool ready{ false };
+  if (ch.onRead && !ch.readOp.pending && !ch.readOp.done) {
+    if (ch.port->head_ != ch.port->tail_) {
+      ready = true;
+    } else if (ch.checkQueue) {
+      ch.checkQueue = false;
+      COMSTAT comStat{};
+      ClearCommError(ch.handle, nullptr, &comStat);
+      // only what is there, EV_RXCHAR tells about the rest
+      if (comStat.cbInQue) {
+        DWORD wanted = static_cast<DWORD>(
+            std::min<size_t>(comStat.cbInQue, ch.in.size()));
+        start(ch.readOp, ReadFile(ch.handle, ch.in.data(), wanted, nullptr,
+                                  &ch.readOp));
+      }
+    }
+  }
+  if (!ch.writeOp.pending && !ch.writeOp.done && !ch.onWritten.empty()) {
+    if (nextFlight(ch)) {
+      DWORD size = static_cast<DWORD>(ch.flight.size() - ch.flightSent);
+      start(ch.writeOp, WriteFile(ch.handle, ch.flight.data() + ch.flightSent,
+                                  size, nullptr, &ch.writeOp));
+    } else {
+      // only empty writes
+      ready = true;
+    }
+  }
+  return ready || ch.readOp.done || ch.writeOp.done || ch.waitOp.done;
+}
+
+bool serial_loop::dispatch(const std::shared_ptr<channel>& ch) {
+  serial& port = *ch->port;
+  bool    handled{ false };
+  if (ch->waitOp.done) {
+    ch->waitOp.done = false;
+    if (!ch->waitOp.ok) {
+      // the device went away
+      ch->failed = true;
+    } else {
+      if (ch->occurred & EV_RXCHAR)
+        ch->checkQueue = true;
+      unsigned int events = ch->occurred & ch->watched;
+      if (events && ch->onEvent) {
+        event_handler h = ch->onEvent;
+        h(events);
+        handled = true;
+      }
+    }
+  }
+
+  if (attached(ch) && ch->onRead) {
+    if (ch->readOp.done) {
+      ch->readOp.done = false;
+      ch->checkQueue  = true;
+      if (!ch->readOp.ok || ch->readOp.bytes) {
+        completeRead(*ch, ch->readOp.ok ? ch->readOp.bytes : 0);
+        handled = true;
+      }
+    } else if (ch->failed && !ch->readOp.pending) {
+      completeRead(*ch, 0);
+      handled = true;
+    } else if (!ch->readOp.pending && port.head_ != port.tail_) {
+      // bytes readLine() read ahead
+      unsigned long got = port.read(
+          ch->in.data(), static_cast<unsigned int>(ch->in.size()));
+      completeRead(*ch, got);
+      handled = true;
+    }
+  }
+
+  if (attached(ch) && !ch->writeOp.pending && !ch->onWritten.empty()) {
+    bool failed = ch->failed;
+    if (ch->writeOp.done) {
+      ch->writeOp.done = false;
+      if (ch->writeOp.ok) {
+        ch->flightSent += ch->writeOp.bytes;
+        ch->sent += ch->writeOp.bytes;
+      } else {
+        failed = true;
+      }
+    }
+    handled = completeWrites(*ch, failed) || handled;
+  }
+  return handled;
+}
+
+int serial_loop::runOnce(int timeoutMs) {
+  {
+    std::lock_guard<std::mutex> lock{ tasksMutex_ };
+    if (!tasks_.empty())
+      timeoutMs = 0;
+  }
+  std::vector<std::shared_ptr<channel>> active{};
+  active.reserve(channels_.size());
+  for (const auto& [port, ch] : channels_) {
+    if (prepare(*ch))
+      timeoutMs = 0;
+    active.push_back(ch);
+  }
+
+  OVERLAPPED_ENTRY entries[max_events];
+  ULONG            count{ 0 };
+  if (!GetQueuedCompletionStatusEx(
+          completionPort_, entries, max_events, &count,
+          timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs), FALSE)) {
+    if (GetLastError() != WAIT_TIMEOUT)
+      throw serial_exception{ GetLastError() };
+    count = 0;
+  }
+  for (ULONG i = 0; i < count; ++i) {
+    // wake() posts completions without an OVERLAPPED
+    if (!entries[i].lpOverlapped)
+      continue;
+    auto* op = static_cast<channel::operation*>(entries[i].lpOverlapped);
+    DWORD bytes{ 0 };
+    op->ok      = GetOverlappedResult(op->owner->handle, op, &bytes, FALSE);
+    op->bytes   = bytes;
+    op->pending = false;
+    op->done    = true;
+  }
+  std::erase_if(detached_, [](const std::shared_ptr<channel>& ch) {
+    return !ch->inflight();
+  });
+
+  int dispatched{ 0 };
+  for (const auto& ch : active) {
+    if (attached(ch) && dispatch(ch))
+      ++dispatched;
+  }
+  runTasks();
+  return dispatched;
+}
+
+#else
+#ifdef __linux__
+void serial_loop::arm(channel& ch, short events) {
+  if (ch.registered && ch.armed == events)
+    return;
+  int fd = ch.port->serialHandle;
+  if (!events) {
+    // hang ups are reported even without interest
+    if (ch.registered)
+      epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    ch.registered = false;
+    ch.armed      = 0;
+    return;
+  }
+  epoll_event ev{};
+  ev.events   = (events & POLLIN ? EPOLLIN : 0u)
+              | (events & POLLOUT ? EPOLLOUT : 0u);
+  ev.data.ptr = &ch;
+  int op      = ch.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(epollFd_, op, fd, &ev) == -1)
+    throw serial_exception{ errno };
+  ch.registered = true;
+  ch.armed      = events;
+}
+#endif
+
+bool serial_loop::dispatch(const std::shared_ptr<channel>& ch, bool readable,
+                           bool writable) {
+  serial& port = *ch->port;
+  bool    handled{ false };
+  if (ch->onRead && port.head_ != port.tail_) {
+    // bytes readLine() read ahead
+    unsigned long got = port.read(
+        ch->in.data(), static_cast<unsigned int>(ch->in.size()));
+    completeRead(*ch, got);
+    handled = true;
+  } else if (ch->onRead && readable) {
+    ssize_t got = ::read(port.serialHandle, ch->in.data(), ch->in.size());
+    if (got > 0) {
+      completeRead(*ch, static_cast<unsigned long>(got));
+      handled = true;
+    } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+      // EIO once the other side of a pseudo terminal went away
+      completeRead(*ch, 0);
+      handled = true;
+    }
+  }
+  if (writable && attached(ch)) {
+    bool failed{ false };
+    while (nextFlight(*ch)) {
+      ssize_t sent = ::write(port.serialHandle,
+                             ch->flight.data() + ch->flightSent,
+                             ch->flight.size() - ch->flightSent);
+      if (sent > 0) {
+        ch->flightSent += static_cast<size_t>(sent);
+        ch->sent += static_cast<uint64_t>(sent);
+        continue;
+      }
+      if (sent == -1 && errno == EINTR)
+        continue;
+      failed = !(sent == -1 && errno == EAGAIN);
+      break;
+    }
+    handled = completeWrites(*ch, failed) || handled;
+  }
+  return handled;
+}
+
+bool serial_loop::notify(const std::shared_ptr<channel>& ch) {
+  unsigned int events = ch->port->sampleLines() & ch->watched;
+  if (!events || !ch->onEvent)
+    return false;
+  // the handler may replace itself
+  event_handler h = ch->onEvent;
+  h(events);
+  return true;
+}
+
+int serial_loop::runOnce(int timeoutMs) {
+  {
+    std::lock_guard<std::mutex> lock{ tasksMutex_ };
+    if (!tasks_.empty())
+      timeoutMs = 0;
+  }
+  std::vector<std::shared_ptr<channel>> active{};
+  bool                                  sampling{ false };
+#ifndef __linux__
+  std::vector<pollfd>   fds{ { wakePipe_[0], POLLIN, 0 } };
+  std::vector<channel*> polled{};
+#endif
+  for (const auto& [port, ch] : channels_) {
+    short events{ 0 };
+    if (ch->onRead) {
+      events |= POLLIN;
+      if (port->head_ != port->tail_)
+        timeoutMs = 0;
+    }
+    if (!ch->onWritten.empty())
+      events |= POLLOUT;
+#ifdef __linux__
+    arm(*ch, events);
+#else
+    if (events) {
+      fds.push_back({ port->serialHandle, events, 0 });
+      polled.push_back(ch.get());
+    }
+#endif
+    sampling = sampling || ch->watched;
+    if (events || ch->watched)
+      active.push_back(ch);
+  }
+  if (sampling && (timeoutMs < 0 || timeoutMs > serial::lineSampleInterval))
+    timeoutMs = serial::lineSampleInterval;
+
+#ifdef __linux__
+  epoll_event events[max_events];
+  int         count = epoll_wait(epollFd_, events, max_events, timeoutMs);
+  if (count == -1 && errno != EINTR)
+    throw serial_exception{ errno };
+  for (int i = 0; i < count; ++i) {
+    if (!events[i].data.ptr) {
+      drainWake();
+      continue;
+    }
+    short flags{ 0 };
+    if (events[i].events & EPOLLIN)
+      flags |= POLLIN;
+    if (events[i].events & EPOLLOUT)
+      flags |= POLLOUT;
+    if (events[i].events & (EPOLLHUP | EPOLLERR))
+      flags |= POLLHUP;
+    static_cast<channel*>(events[i].data.ptr)->revents = flags;
+  }
+#else
+  if (poll(fds.data(), fds.size(), timeoutMs) == -1 && errno != EINTR)
+    throw serial_exception{ errno };
+  if (fds[0].revents)
+    drainWake();
+  for (size_t i = 0; i < polled.size(); ++i) {
+    polled[i]->revents = fds[i + 1].revents;
+  }
+#endif
+
+  int dispatched{ 0 };
+  for (const auto& ch : active) {
+    short revents = ch->revents;
+    ch->revents   = 0;
+    if (!attached(ch))
+      continue;
+    bool readable = revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL);
+    bool writable = revents & (POLLOUT | POLLHUP | POLLERR | POLLNVAL);
+    bool handled  = dispatch(ch, readable, writable);
+    if (ch->watched && attached(ch))
+      handled = notify(ch) || handled;
+    if (handled)
+      ++dispatched;
+  }
+  runTasks();
+  return dispatched;
+}
+#endif
+
+void serial_loop::post(task t) {
+  {
+    std::lock_guard<std::mutex> lock{ tasksMutex_ };
+    tasks_.push_back(std::move(t));
+  }
+  wake();
+}
+
+void serial_loop::wake() {
+#ifdef _WIN32
+  PostQueuedCompletionStatus(completionPort_, 0, 0, nullptr);
+#else
+  byte one = 1;
+  [[maybe_unused]] auto written = ::write(wakePipe_[1], &one, 1);
+#endif
+}
+
+void serial_loop::drainWake() {
+#ifndef _WIN32
+  byte buffer[64];
+  while (::read(wakePipe_[0], buffer, sizeof(buffer)) > 0)
+    ;
+#endif
+}
+
+void serial_loop::runTasks() {
+  std::vector<task> tasks;
+  {
+    std::lock_guard<std::mutex> lock{ tasksMutex_ };
+    tasks.swap(tasks_);
+  }
+  for (auto& t : tasks) {
+    t();
+  }
+}
+
+void serial_loop::run() {
+  while (!stopped_.load()) {
+    runOnce();
+  }
+  stopped_ = false;
+}
+
+void serial_loop::stop() {
+  stopped_ = true;
+  wake();
+}
+
+size_t serial_loop::size() const {
+  return channels_.size();
+}
+} // namespace serialio
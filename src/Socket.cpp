@@ -1,16 +1,413 @@
 #include "Socket.hpp"
 
+#include "Framing.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
 #include <chrono>
+#include <cstring>
+#include <future>
+#include <iterator>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <netinet/tcp.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define SOCKETIO_ZEROCOPY
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOCKETIO_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SOCKETIO_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define SOCKETIO_AVX2
+#include <immintrin.h>
+#endif
 
 namespace {
+// largest plaintext a single TLS record can carry
+constexpr size_t tls_record_size = 16 * 1024;
+// chunk size of the user-space send_file fallback
+constexpr size_t file_chunk_size = 64 * 1024;
+// RFC 8305 connection attempt delay before racing the next address
+constexpr int connection_attempt_delay = 250;
+// how often sockets closed with zero-copy sends in flight are checked
+constexpr auto zerocopy_reap_interval = std::chrono::milliseconds{ 10 };
+
 int sock_close(SOCKET& sock) {
-  int status{ 0 };
-  status = shutdown(sock, SD_BOTH);
-  if (status == 0)
-    status = closesocket(sock);
-  return status;
+  // shutdown fails on listening and unconnected sockets, close them anyway
+  shutdown(sock, SD_BOTH);
+  return closesocket(sock);
+}
+
+#ifdef SOCKETIO_SSE2
+inline unsigned first_set(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+const socketio::byte* find_byte_sse2(const socketio::byte* begin,
+                                     const socketio::byte* end,
+                                     socketio::byte        value) {
+  const __m128i needle = _mm_set1_epi8(static_cast<char>(value));
+  for (; end - begin >= 16; begin += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if (mask)
+      return begin + first_set(mask);
+  }
+  return static_cast<const socketio::byte*>(
+      memchr(begin, value, static_cast<size_t>(end - begin)));
+}
+#endif
+
+#ifdef SOCKETIO_AVX2
+__attribute__((target("avx2"))) const socketio::byte*
+find_byte_avx2(const socketio::byte* begin, const socketio::byte* end,
+               socketio::byte value) {
+  const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+  for (; end - begin >= 32; begin += 32) {
+    __m256i chunk
+        = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    unsigned mask = static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+    if (mask)
+      return begin + first_set(mask);
+  }
+  return find_byte_sse2(begin, end, value);
+}
+#endif
+
+/**
+ * @brief finds the first occurrence of value in [begin, end)
+ *
+ * @return pointer to the match or nullptr
+ */
+const socketio::byte* find_byte(const socketio::byte* begin,
+                                const socketio::byte* end,
+                                socketio::byte        value) {
+  if (begin == end)
+    return nullptr;
+#if defined(SOCKETIO_AVX2)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    return find_byte_avx2(begin, end, value);
+  return find_byte_sse2(begin, end, value);
+#elif defined(SOCKETIO_SSE2)
+  return find_byte_sse2(begin, end, value);
+#else
+  return static_cast<const socketio::byte*>(
+      memchr(begin, value, static_cast<size_t>(end - begin)));
+#endif
+}
+
+/**
+ * @brief makes blocking sends and receives on sock give up after timeout_ms
+ * @note -1 waits forever
+ */
+void set_socket_timeout(SOCKET sock, int timeout_ms) {
+#ifdef _WIN32
+  DWORD timeout = timeout_ms < 0 ? 0 : static_cast<DWORD>(timeout_ms);
+#else
+  timeval timeout{};
+  if (timeout_ms > 0) {
+    timeout.tv_sec  = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  } else if (timeout_ms == 0) {
+    // a zero timeval means forever
+    timeout.tv_usec = 1;
+  }
+#endif
+  if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*) &timeout,
+                 sizeof(timeout))
+          == SOCKET_ERROR
+      || setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char*) &timeout,
+                    sizeof(timeout))
+             == SOCKET_ERROR) {
+    throw socketio::socket_exception{ "Unable to set socket timeout: "
+                                      + std::string{ strerror(errno) } };
+  }
+}
+
+/**
+ * @brief milliseconds left of a timeout that started at start, -1 for none
+ *
+ */
+int time_left(int timeout_ms, std::chrono::steady_clock::time_point start) {
+  if (timeout_ms < 0)
+    return -1;
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  return elapsed >= timeout_ms ? 0 : timeout_ms - static_cast<int>(elapsed);
+}
+
+/**
+ * @brief smaller of two time_left() values
+ *
+ */
+int min_time_left(int a, int b) {
+  if (a < 0)
+    return b;
+  if (b < 0)
+    return a;
+  return std::min(a, b);
+}
+
+bool set_socket_blocking(SOCKET sock, bool blocking) {
+#ifdef _WIN32
+  u_long mode = blocking ? 0 : 1;
+  return ioctlsocket(sock, FIONBIO, &mode) != SOCKET_ERROR;
+#else
+  int flags = fcntl(sock, F_GETFL, 0);
+  return flags != -1
+         && fcntl(sock, F_SETFL,
+                  blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK))
+                != -1;
+#endif
+}
+
+/**
+ * @brief orders addresses for Happy Eyeballs, alternating between address
+ * families and starting with the family of the first (preferred) one
+ *
+ */
+std::vector<const addrinfo*> interleave_families(const addrinfo* addr_info) {
+  std::vector<const addrinfo*> preferred{};
+  std::vector<const addrinfo*> others{};
+  for (const addrinfo* cur = addr_info; cur != nullptr; cur = cur->ai_next) {
+    if (cur->ai_family == addr_info->ai_family)
+      preferred.push_back(cur);
+    else
+      others.push_back(cur);
+  }
+  std::vector<const addrinfo*> ordered{};
+  ordered.reserve(preferred.size() + others.size());
+  for (size_t i = 0; i < std::max(preferred.size(), others.size()); ++i) {
+    if (i < preferred.size())
+      ordered.push_back(preferred[i]);
+    if (i < others.size())
+      ordered.push_back(others[i]);
+  }
+  return ordered;
+}
+
+#ifdef USE_OPENSSL
+
+/**
+ * @brief reports a TLS operation that has to wait for the socket the way a
+ * plain non-blocking one does, so would_block() holds
+ *
+ */
+int want_retry() {
+#ifdef _WIN32
+  WSASetLastError(WSAEWOULDBLOCK);
+#else
+  errno = EWOULDBLOCK;
+#endif
+  return -1;
+}
+
+/**
+ * @brief waits until sock is readable (or writable)
+ *
+ * @return false if timeout_ms passed first
+ */
+bool wait_ready(SOCKET sock, bool write, int timeout_ms) {
+  auto   start = std::chrono::steady_clock::now();
+  pollfd pfd{};
+  pfd.fd     = sock;
+  pfd.events = write ? POLLOUT : POLLIN;
+  while (true) {
+#ifdef _WIN32
+    int ready = WSAPoll(&pfd, 1, time_left(timeout_ms, start));
+#else
+    int ready = ::poll(&pfd, 1, time_left(timeout_ms, start));
+#endif
+    if (ready > 0)
+      return true;
+    if (ready == 0)
+      return false;
+#ifndef _WIN32
+    if (errno == EINTR)
+      continue;
+#endif
+    throw socketio::socket_exception{ "Unable to wait for socket: "
+                            + std::string{ strerror(errno) } };
+  }
+}
+
+void init_openssl() {
+  static socketio::openssl_handler _ssl_handler_life;
+}
+
+std::string ssl_error_string() {
+  unsigned long error = ERR_get_error();
+  if (!error)
+    return "unknown error";
+  return std::string{ ERR_error_string(error, nullptr) };
+}
+
+void free_session_key(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+  delete static_cast<std::string*>(ptr);
 }
+
+/**
+ * @brief ex data slot of SSL handles holding their session cache key
+ *
+ * @return int
+ */
+int session_key_index() {
+  static const int index
+      = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, free_session_key);
+  return index;
+}
+#endif
+
+/**
+ * @brief process wide getaddrinfo cache with a time to live
+ * @note lookups of the same key that overlap wait for the first one instead
+ * of all hitting the resolver
+ */
+class resolver_cache {
+  using clock     = std::chrono::steady_clock;
+  using addresses = std::shared_ptr<addrinfo>;
+
+  struct entry {
+    addresses         addr_info;
+    clock::time_point expires;
+  };
+
+  // sweep expired entries once the cache grows past this
+  static constexpr size_t sweep_size = 64;
+
+  std::mutex                                                     mutex_;
+  std::unordered_map<std::string, entry>                         entries_;
+  std::unordered_map<std::string, std::shared_future<addresses>> pending_;
+  std::chrono::milliseconds                                      ttl_;
+
+  resolver_cache()
+      : mutex_{}
+      , entries_{}
+      , pending_{}
+      , ttl_{ std::chrono::seconds{ 30 } } {
+  }
+
+  static addresses lookup(const char* domain, const char* port) {
+    addrinfo hints{};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result{ nullptr };
+    int       error = getaddrinfo(domain, port, &hints, &result);
+    if (error) {
+      throw socketio::socket_exception{ "Error getting address info: "
+                                        + std::string{ gai_strerror(error) } };
+    }
+    return { result, freeaddrinfo };
+  }
+
+  addresses find_locked(const std::string& key) {
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+      return nullptr;
+    if (it->second.expires <= clock::now()) {
+      entries_.erase(it);
+      return nullptr;
+    }
+    return it->second.addr_info;
+  }
+
+  void store_locked(const std::string& key, const addresses& addr_info) {
+    if (ttl_.count() <= 0)
+      return;
+    auto now = clock::now();
+    if (entries_.size() >= sweep_size) {
+      std::erase_if(entries_,
+                    [now](const auto& e) { return e.second.expires <= now; });
+    }
+    entries_[key] = { addr_info, now + ttl_ };
+  }
+
+public:
+  static resolver_cache& instance() {
+    static resolver_cache cache{};
+    return cache;
+  }
+
+  addresses find(const std::string& domain, const std::string& port) {
+    std::lock_guard<std::mutex> lock{ mutex_ };
+    return find_locked(domain + ":" + port);
+  }
+
+  addresses resolve(const char* domain, const char* port) {
+    std::string                  key = std::string{ domain } + ":" + port;
+    std::unique_lock<std::mutex> lock{ mutex_ };
+    if (addresses addr_info = find_locked(key))
+      return addr_info;
+    if (auto it = pending_.find(key); it != pending_.end()) {
+      std::shared_future<addresses> result = it->second;
+      lock.unlock();
+      return result.get();
+    }
+    std::promise<addresses> promise{};
+    pending_.emplace(key, promise.get_future().share());
+    lock.unlock();
+
+    try {
+      addresses addr_info = lookup(domain, port);
+      lock.lock();
+      store_locked(key, addr_info);
+      pending_.erase(key);
+      lock.unlock();
+      promise.set_value(addr_info);
+      return addr_info;
+    } catch (...) {
+      if (!lock.owns_lock())
+        lock.lock();
+      pending_.erase(key);
+      lock.unlock();
+      promise.set_exception(std::current_exception());
+      throw;
+    }
+  }
+
+  void set_ttl(std::chrono::milliseconds ttl) {
+    std::lock_guard<std::mutex> lock{ mutex_ };
+    ttl_ = ttl;
+    if (ttl_.count() <= 0)
+      entries_.clear();
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock{ mutex_ };
+    entries_.clear();
+  }
+};
 } // namespace
 
 namespace socketio {
@@ -65,250 +462,1844 @@ socket_exception::socket_exception(const std::string& msg) noexcept
     : msg_{ msg } {
 }
 
-const char* socket_exception::what() const noexcept {
-  return msg_.c_str();
+const char* socket_exception::what() const noexcept {
+  return msg_.c_str();
+}
+
+int last_socket_error() {
+#ifdef _WIN32
+  return WSAGetLastError();
+#else
+  return errno;
+#endif
+}
+
+bool would_block() {
+  int error = last_socket_error();
+#ifdef _WIN32
+  return error == WSAEWOULDBLOCK;
+#else
+  return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+#endif
+}
+
+byte_buffer::byte_buffer(size_t capacity, std::pmr::memory_resource* resource)
+    : resource_{ resource ? resource : &buffer_pool::global() }
+    , data_{ capacity ? static_cast<byte*>(resource_->allocate(capacity))
+                      : nullptr }
+    , capacity_{ capacity }
+    , begin_{ 0 }
+    , end_{ 0 } {
+}
+
+byte_buffer::~byte_buffer() {
+  reset();
+}
+
+byte_buffer::byte_buffer(byte_buffer&& other) noexcept
+    : resource_{ other.resource_ }
+    , data_{ std::exchange(other.data_, nullptr) }
+    , capacity_{ std::exchange(other.capacity_, 0) }
+    , begin_{ std::exchange(other.begin_, 0) }
+    , end_{ std::exchange(other.end_, 0) } {
+}
+
+byte_buffer& byte_buffer::operator=(byte_buffer&& other) noexcept {
+  if (this != &other) {
+    reset();
+    resource_ = other.resource_;
+    data_     = std::exchange(other.data_, nullptr);
+    capacity_ = std::exchange(other.capacity_, 0);
+    begin_    = std::exchange(other.begin_, 0);
+    end_      = std::exchange(other.end_, 0);
+  }
+  return *this;
+}
+
+byte* byte_buffer::data() {
+  return data_ + begin_;
+}
+
+const byte* byte_buffer::data() const {
+  return data_ + begin_;
+}
+
+size_t byte_buffer::size() const {
+  return end_ - begin_;
+}
+
+bool byte_buffer::empty() const {
+  return begin_ == end_;
+}
+
+std::string_view byte_buffer::view() const {
+  return { reinterpret_cast<const char*>(data()), size() };
+}
+
+void byte_buffer::consume(size_t size) {
+  begin_ += std::min(size, this->size());
+  if (begin_ == end_)
+    begin_ = end_ = 0;
+}
+
+byte* byte_buffer::prepare(size_t size) {
+  if (capacity_ - end_ >= size)
+    return data_ + end_;
+  size_t used = this->size();
+  if (capacity_ - used >= size) {
+    // enough room once the consumed front is reclaimed
+    memmove(data_, data(), used);
+  } else {
+    // powers of two fill the pool's size classes exactly
+    size_t capacity = std::bit_ceil(std::max(capacity_ * 2, used + size));
+    auto*  grown    = static_cast<byte*>(resource_->allocate(capacity));
+    if (used)
+      memcpy(grown, data(), used);
+    if (data_)
+      resource_->deallocate(data_, capacity_);
+    data_     = grown;
+    capacity_ = capacity;
+  }
+  begin_ = 0;
+  end_   = used;
+  return data_ + end_;
+}
+
+void byte_buffer::commit(size_t size) {
+  end_ = std::min(end_ + size, capacity_);
+}
+
+void byte_buffer::clear() {
+  begin_ = end_ = 0;
+}
+
+void byte_buffer::reset() {
+  if (data_)
+    resource_->deallocate(data_, capacity_);
+  data_     = nullptr;
+  capacity_ = 0;
+  begin_ = end_ = 0;
+}
+
+tcp_socket::tcp_socket(SOCKET s)
+    : ept_{}
+    , rbuf_{}
+    , frame_checked_{ 0 }
+    , timeout_{ -1 }
+    , connect_timeout_{ -1 }
+    , attempt_timeout_{ -1 }
+    , zerocopy_threshold_{ 0 }
+    , zerocopy_seq_{ 0 }
+    , zerocopy_pending_{}
+    , wbuf_{}
+    , write_threshold_{ 0 }
+    , flush_delay_{ -1 }
+    , buffered_since_{} {
+  sock = s;
+}
+
+std::string tcp_socket::get_ssl_error() {
+#ifdef USE_OPENSSL
+  return ssl_error_string();
+#else
+  return "";
+#endif
+}
+
+endpoint::endpoint()
+    : domain{}
+    , port{}
+    , addr_info{} {
+}
+
+endpoint::endpoint(const char* domain, const char* port)
+    : endpoint{} {
+  this->domain = domain;
+  this->port   = static_cast<short>(atoi(port));
+  addr_info    = resolver_cache::instance().resolve(domain, port);
+}
+
+endpoint::endpoint(const std::string& domain, const char* port)
+    : endpoint{ domain.c_str(), port } {
+}
+
+endpoint::endpoint(endpoint&& other) noexcept
+    : domain{ std::move(other.domain) }
+    , port{ std::exchange(other.port, 0) }
+    , addr_info{ std::move(other.addr_info) } {
+}
+
+endpoint& endpoint::operator=(endpoint&& other) noexcept {
+  if (this != &other) {
+    domain    = std::move(other.domain);
+    port      = std::exchange(other.port, 0);
+    addr_info = std::move(other.addr_info);
+  }
+  return *this;
+}
+
+endpoint::~endpoint() {
+}
+
+endpoint::operator addrinfo*() {
+  return addr_info.get();
+}
+
+std::future<endpoint> endpoint::resolve_async(std::string domain,
+                                              std::string port) {
+  return std::async(std::launch::async, [domain{ std::move(domain) },
+                                         port{ std::move(port) }] {
+    return endpoint{ domain, port.c_str() };
+  });
+}
+
+std::optional<endpoint> endpoint::cached(const std::string& domain,
+                                         const std::string& port) {
+  std::shared_ptr<addrinfo> addr_info
+      = resolver_cache::instance().find(domain, port);
+  if (!addr_info)
+    return std::nullopt;
+  endpoint ept{};
+  ept.domain    = domain;
+  ept.port      = static_cast<short>(atoi(port.c_str()));
+  ept.addr_info = std::move(addr_info);
+  return ept;
+}
+
+void endpoint::set_cache_ttl(std::chrono::milliseconds ttl) {
+  resolver_cache::instance().set_ttl(ttl);
+}
+
+void endpoint::clear_cache() {
+  resolver_cache::instance().clear();
+}
+
+#ifdef USE_OPENSSL
+struct tls_context::state : std::enable_shared_from_this<state> {
+  SSL_CTX* ctx;
+  tls_role role;
+  bool     verify_peer;
+  bool     cache_sessions;
+
+  std::mutex                                    mutex;
+  std::unordered_map<std::string, SSL_SESSION*> sessions;
+
+  // protocols in ALPN wire format (length prefixed)
+  std::vector<unsigned char> alpn;
+  sni_handler                sni;
+
+  state(SSL_CTX* ctx, tls_role role)
+      : ctx{ ctx }
+      , role{ role }
+      , verify_peer{ false }
+      , cache_sessions{ true }
+      , mutex{}
+      , sessions{}
+      , alpn{}
+      , sni{} {
+  }
+
+  ~state() {
+    clear();
+    SSL_CTX_free(ctx);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock{ mutex };
+    for (auto& [key, session] : sessions) {
+      SSL_SESSION_free(session);
+    }
+    sessions.clear();
+  }
+
+  /**
+   * @brief cached session for key with an added reference, or nullptr
+   *
+   */
+  SSL_SESSION* find(const std::string& key) {
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto                        it = sessions.find(key);
+    if (it == sessions.end())
+      return nullptr;
+    if (!SSL_SESSION_is_resumable(it->second)) {
+      SSL_SESSION_free(it->second);
+      sessions.erase(it);
+      return nullptr;
+    }
+    SSL_SESSION_up_ref(it->second);
+    return it->second;
+  }
+
+  /**
+   * @brief OpenSSL new session callback; TLS 1.3 tickets arrive after the
+   * handshake, with the first read
+   */
+  static int on_new_session(SSL* ssl, SSL_SESSION* session) {
+    auto* self
+        = static_cast<state*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    auto* key
+        = static_cast<std::string*>(SSL_get_ex_data(ssl, session_key_index()));
+    if (!self || !key || !self->cache_sessions)
+      return 0;
+    std::lock_guard<std::mutex> lock{ self->mutex };
+    SSL_SESSION*&               cached = self->sessions[*key];
+    if (cached)
+      SSL_SESSION_free(cached);
+    // keep the reference OpenSSL hands us
+    cached = session;
+    return 1;
+  }
+
+  /**
+   * @brief OpenSSL ALPN callback of servers; picks the first own protocol
+   * the client offers
+   */
+  static int on_alpn_select(SSL*, const unsigned char** out,
+                            unsigned char* out_size, const unsigned char* in,
+                            unsigned int in_size, void* arg) {
+    auto*          self = static_cast<state*>(arg);
+    unsigned char* selected{ nullptr };
+    if (SSL_select_next_proto(&selected, out_size, self->alpn.data(),
+                              static_cast<unsigned int>(self->alpn.size()),
+                              in, in_size)
+        != OPENSSL_NPN_NEGOTIATED)
+      return SSL_TLSEXT_ERR_NOACK;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+  }
+
+  /**
+   * @brief OpenSSL server name callback of servers; switches the SSL_CTX to
+   * the one chosen by the sni handler
+   */
+  static int on_server_name(SSL* ssl, int* alert, void* arg) {
+    auto*       self = static_cast<state*>(arg);
+    const char* name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    tls_context selected{ self->shared_from_this() };
+    try {
+      if (!self->sni(name ? name : "", selected)) {
+        *alert = SSL_AD_UNRECOGNIZED_NAME;
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+      }
+    } catch (...) {
+      *alert = SSL_AD_INTERNAL_ERROR;
+      return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    if (selected.state_.get() != self) {
+      SSL_set_SSL_CTX(ssl, selected.state_->ctx);
+      // the callbacks of the new context point to its state
+      SSL_set_ex_data(ssl, context_index(),
+                      new std::shared_ptr<state>{ selected.state_ });
+    }
+    return SSL_TLSEXT_ERR_OK;
+  }
+
+  static void free_context(void*, void* ptr, CRYPTO_EX_DATA*, int, long,
+                           void*) {
+    delete static_cast<std::shared_ptr<state>*>(ptr);
+  }
+
+  /**
+   * @brief ex data slot of SSL handles keeping a context chosen by sni alive
+   *
+   */
+  static int context_index() {
+    static const int index
+        = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, free_context);
+    return index;
+  }
+};
+#endif
+
+tls_context::tls_context(std::shared_ptr<state> state)
+    : state_{ std::move(state) } {
+}
+
+tls_context::tls_context([[maybe_unused]] tls_role role) {
+#ifdef USE_OPENSSL
+  init_openssl();
+
+  SSL_CTX* ctx = SSL_CTX_new(role == TLS_SERVER ? TLS_server_method()
+                                                : TLS_client_method());
+  if (!ctx) {
+    throw ssl_exception{ "Unable to create SSL context: "
+                         + ssl_error_string() };
+  }
+  state_ = std::make_shared<state>(ctx, role);
+  SSL_CTX_set_app_data(ctx, state_.get());
+  if (role == TLS_SERVER) {
+    static const unsigned char session_id_context[] = "socketio";
+    SSL_CTX_set_session_id_context(ctx, session_id_context,
+                                   sizeof(session_id_context) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  } else {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+                                            | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &state::on_new_session);
+  }
+#else
+  throw ssl_exception{
+    "To use the tls_context class you need to #define USE_OPENSSL"
+  };
+#endif
+}
+
+tls_role tls_context::role() const {
+#ifdef USE_OPENSSL
+  return state_->role;
+#else
+  return TLS_CLIENT;
+#endif
+}
+
+void tls_context::set_verify([[maybe_unused]] bool verify_peer) {
+#ifdef USE_OPENSSL
+  int mode = SSL_VERIFY_NONE;
+  if (verify_peer) {
+    mode = state_->role == TLS_SERVER
+               ? SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT
+               : SSL_VERIFY_PEER;
+  }
+  state_->verify_peer = verify_peer;
+  SSL_CTX_set_verify(state_->ctx, mode, nullptr);
+#endif
+}
+
+void tls_context::set_default_verify_paths() {
+#ifdef USE_OPENSSL
+  if (!SSL_CTX_set_default_verify_paths(state_->ctx)) {
+    throw ssl_exception{ "Unable to load default certificates: "
+                         + ssl_error_string() };
+  }
+#endif
+}
+
+void tls_context::load_verify_locations(
+    [[maybe_unused]] const std::string& ca_file,
+    [[maybe_unused]] const std::string& ca_path) {
+#ifdef USE_OPENSSL
+  if (!SSL_CTX_load_verify_locations(
+          state_->ctx, ca_file.empty() ? nullptr : ca_file.c_str(),
+          ca_path.empty() ? nullptr : ca_path.c_str())) {
+    throw ssl_exception{ "Unable to load certificates: "
+                         + ssl_error_string() };
+  }
+#endif
+}
+
+void tls_context::use_certificate(
+    [[maybe_unused]] const std::string& cert_file,
+    [[maybe_unused]] const std::string& key_file) {
+#ifdef USE_OPENSSL
+  if (SSL_CTX_use_certificate_chain_file(state_->ctx, cert_file.c_str()) != 1
+      || SSL_CTX_use_PrivateKey_file(state_->ctx, key_file.c_str(),
+                                     SSL_FILETYPE_PEM)
+             != 1
+      || SSL_CTX_check_private_key(state_->ctx) != 1) {
+    throw ssl_exception{ "Unable to load certificate: "
+                         + ssl_error_string() };
+  }
+#endif
+}
+
+void tls_context::set_ciphers([[maybe_unused]] const std::string& ciphers) {
+#ifdef USE_OPENSSL
+  if (!SSL_CTX_set_cipher_list(state_->ctx, ciphers.c_str())) {
+    throw ssl_exception{ "Invalid cipher list: " + ssl_error_string() };
+  }
+#endif
+}
+
+void tls_context::set_ciphersuites(
+    [[maybe_unused]] const std::string& ciphersuites) {
+#ifdef USE_OPENSSL
+  if (!SSL_CTX_set_ciphersuites(state_->ctx, ciphersuites.c_str())) {
+    throw ssl_exception{ "Invalid cipher suites: " + ssl_error_string() };
+  }
+#endif
+}
+
+void tls_context::set_alpn(
+    [[maybe_unused]] const std::vector<std::string>& protocols) {
+#ifdef USE_OPENSSL
+  std::vector<unsigned char> wire{};
+  for (const std::string& protocol : protocols) {
+    if (protocol.empty() || protocol.size() > 255) {
+      throw ssl_exception{ "Invalid ALPN protocol: " + protocol };
+    }
+    wire.push_back(static_cast<unsigned char>(protocol.size()));
+    wire.insert(wire.end(), protocol.begin(), protocol.end());
+  }
+  state_->alpn = std::move(wire);
+  if (state_->role == TLS_SERVER) {
+    SSL_CTX_set_alpn_select_cb(state_->ctx, &state::on_alpn_select,
+                               state_.get());
+  } else if (SSL_CTX_set_alpn_protos(
+                 state_->ctx, state_->alpn.data(),
+                 static_cast<unsigned int>(state_->alpn.size()))) {
+    throw ssl_exception{ "Unable to set ALPN protocols: "
+                         + ssl_error_string() };
+  }
+#endif
+}
+
+void tls_context::set_sni_handler([[maybe_unused]] sni_handler handler) {
+#ifdef USE_OPENSSL
+  if (state_->role != TLS_SERVER) {
+    throw ssl_exception{ "SNI handlers need a server context" };
+  }
+  state_->sni = std::move(handler);
+  if (state_->sni)
+    SSL_CTX_set_tlsext_servername_callback(state_->ctx, &state::on_server_name);
+  else
+    SSL_CTX_set_tlsext_servername_callback(state_->ctx, nullptr);
+  SSL_CTX_set_tlsext_servername_arg(state_->ctx, state_.get());
+#endif
+}
+
+bool tls_context::set_ktls([[maybe_unused]] bool enable) {
+#if defined(USE_OPENSSL) && defined(SSL_OP_ENABLE_KTLS)
+  if (enable)
+    SSL_CTX_set_options(state_->ctx, SSL_OP_ENABLE_KTLS);
+  else
+    SSL_CTX_clear_options(state_->ctx, SSL_OP_ENABLE_KTLS);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void tls_context::set_session_cache([[maybe_unused]] bool enable) {
+#ifdef USE_OPENSSL
+  state_->cache_sessions = enable;
+  if (state_->role == TLS_SERVER) {
+    SSL_CTX_set_session_cache_mode(
+        state_->ctx, enable ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+    if (enable)
+      SSL_CTX_clear_options(state_->ctx, SSL_OP_NO_TICKET);
+    else
+      SSL_CTX_set_options(state_->ctx, SSL_OP_NO_TICKET);
+  }
+  if (!enable)
+    clear_sessions();
+#endif
+}
+
+void tls_context::clear_sessions() {
+#ifdef USE_OPENSSL
+  if (state_->role == TLS_SERVER)
+    SSL_CTX_flush_sessions(state_->ctx, LONG_MAX);
+  state_->clear();
+#endif
+}
+
+size_t tls_context::cached_sessions() const {
+#ifdef USE_OPENSSL
+  if (state_->role == TLS_SERVER)
+    return static_cast<size_t>(SSL_CTX_sess_number(state_->ctx));
+  std::lock_guard<std::mutex> lock{ state_->mutex };
+  return state_->sessions.size();
+#else
+  return 0;
+#endif
+}
+
+#ifdef USE_OPENSSL
+SSL_CTX* tls_context::native_handle() const {
+  return state_->ctx;
+}
+#endif
+
+wsa_handler base_socket::_wsa_handler = wsa_handler{};
+
+base_socket::base_socket()
+    : sock{ INVALID_SOCKET }
+    , blocking_{ true } {
+}
+
+base_socket::base_socket(base_socket&& other) noexcept
+    : sock{ std::exchange(other.sock, INVALID_SOCKET) }
+    , blocking_{ std::exchange(other.blocking_, true) } {
+}
+
+base_socket& base_socket::operator=(base_socket&& other) noexcept {
+  if (this != &other) {
+    sock      = std::exchange(other.sock, INVALID_SOCKET);
+    blocking_ = std::exchange(other.blocking_, true);
+  }
+  return *this;
+}
+
+SOCKET base_socket::native_handle() const {
+  return sock;
+}
+
+void base_socket::set_blocking(bool blocking) {
+  if (!set_socket_blocking(sock, blocking)) {
+    throw socket_exception{ "Unable to change blocking mode: "
+                            + std::string{ strerror(errno) } };
+  }
+  blocking_ = blocking;
+}
+
+tcp_socket::tcp_socket()
+    : base_socket{}
+    , ept_{}
+    , rbuf_{}
+    , frame_checked_{ 0 }
+    , timeout_{ -1 }
+    , connect_timeout_{ -1 }
+    , attempt_timeout_{ -1 }
+    , zerocopy_threshold_{ 0 }
+    , zerocopy_seq_{ 0 }
+    , zerocopy_pending_{}
+    , wbuf_{}
+    , write_threshold_{ 0 }
+    , flush_delay_{ -1 }
+    , buffered_since_{}
+#ifdef USE_OPENSSL
+    , ssl{ nullptr }
+    , ssl_ctx{ nullptr }
+#endif
+{
+}
+
+tcp_socket::tcp_socket(tcp_socket&& other) noexcept
+    : base_socket{ std::move(other) }
+    , ept_{ std::move(other.ept_) }
+    , rbuf_{ std::move(other.rbuf_) }
+    , frame_checked_{ std::exchange(other.frame_checked_, 0) }
+    , timeout_{ other.timeout_ }
+    , connect_timeout_{ other.connect_timeout_ }
+    , attempt_timeout_{ other.attempt_timeout_ }
+    , zerocopy_threshold_{ std::exchange(other.zerocopy_threshold_, 0) }
+    , zerocopy_seq_{ std::exchange(other.zerocopy_seq_, 0) }
+    , zerocopy_pending_{ std::exchange(other.zerocopy_pending_, {}) }
+    , wbuf_{ std::move(other.wbuf_) }
+    , write_threshold_{ std::exchange(other.write_threshold_, 0) }
+    , flush_delay_{ std::exchange(other.flush_delay_, -1) }
+    , buffered_since_{ other.buffered_since_ }
+#ifdef USE_OPENSSL
+    , ssl{ std::move(other.ssl) }
+    , ssl_ctx{ std::move(other.ssl_ctx) }
+#endif
+{
+}
+
+tcp_socket& tcp_socket::operator=(tcp_socket&& other) noexcept {
+  if (this != &other) {
+    close();
+    base_socket::operator=(std::move(other));
+    ept_                = std::move(other.ept_);
+    rbuf_               = std::move(other.rbuf_);
+    frame_checked_      = std::exchange(other.frame_checked_, 0);
+    timeout_            = other.timeout_;
+    connect_timeout_    = other.connect_timeout_;
+    attempt_timeout_    = other.attempt_timeout_;
+    zerocopy_threshold_ = std::exchange(other.zerocopy_threshold_, 0);
+    zerocopy_seq_       = std::exchange(other.zerocopy_seq_, 0);
+    zerocopy_pending_   = std::exchange(other.zerocopy_pending_, {});
+    wbuf_               = std::move(other.wbuf_);
+    write_threshold_    = std::exchange(other.write_threshold_, 0);
+    flush_delay_        = std::exchange(other.flush_delay_, -1);
+    buffered_since_     = other.buffered_since_;
+#ifdef USE_OPENSSL
+    ssl     = std::move(other.ssl);
+    ssl_ctx = std::move(other.ssl_ctx);
+#endif
+  }
+  return *this;
+}
+
+tcp_socket::~tcp_socket() {
+  close();
+}
+
+#ifdef USE_OPENSSL
+void tcp_socket::ssl_deleter::operator()(SSL* ssl) const noexcept {
+  SSL_free(ssl);
+}
+#endif
+
+bool tcp_socket::is_valid() const {
+  return sock != INVALID_SOCKET;
+}
+
+bool tcp_socket::is_connected() const {
+  return sock != INVALID_SOCKET;
+}
+
+bool tcp_socket::is_secure() const {
+#ifdef USE_OPENSSL
+  return ssl != nullptr;
+#else
+  return false;
+#endif
+}
+
+void tcp_socket::connect(endpoint ept) {
+  struct attempt {
+    SOCKET                                sock;
+    std::chrono::steady_clock::time_point started;
+  };
+
+  close();
+  std::vector<const addrinfo*> addrs = interleave_families(ept);
+  std::vector<attempt>         attempts{};
+  std::vector<pollfd>          pfds{};
+  std::string                  error_string{ "Unable to connect" };
+  auto                         start      = std::chrono::steady_clock::now();
+  auto                         last_start = start;
+  size_t                       next{ 0 };
+
+  auto abandon = [&attempts](size_t i) {
+    sock_close(attempts[i].sock);
+    attempts.erase(attempts.begin() + static_cast<std::ptrdiff_t>(i));
+  };
+
+  while (sock == INVALID_SOCKET) {
+    if (next < addrs.size()
+        && (attempts.empty()
+            || time_left(connection_attempt_delay, last_start) == 0)) {
+      const addrinfo* addr = addrs[next++];
+      SOCKET          s
+          = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+      if (s == INVALID_SOCKET) {
+        error_string
+            = "Unable to open socket: " + std::string{ strerror(errno) };
+        continue;
+      }
+      last_start = std::chrono::steady_clock::now();
+      if (!set_socket_blocking(s, false)) {
+        sock_close(s);
+        continue;
+      }
+      if (::connect(s, addr->ai_addr, (int) addr->ai_addrlen) == 0) {
+        sock = s;
+        break;
+      }
+#ifdef _WIN32
+      if (WSAGetLastError() == WSAEWOULDBLOCK) {
+#else
+      if (errno == EINPROGRESS) {
+#endif
+        attempts.push_back({ s, last_start });
+      } else {
+        error_string = "Unable to connect: " + std::string{ strerror(errno) };
+        sock_close(s);
+      }
+      continue;
+    }
+    if (attempts.empty())
+      break;
+
+    int wait = time_left(connect_timeout_, start);
+    if (wait == 0) {
+      error_string = "Timed out connecting";
+      break;
+    }
+    if (next < addrs.size()) {
+      wait = min_time_left(wait,
+                           time_left(connection_attempt_delay, last_start));
+    }
+    for (const attempt& a : attempts) {
+      wait = min_time_left(wait, time_left(attempt_timeout_, a.started));
+    }
+
+    pfds.clear();
+    for (const attempt& a : attempts) {
+      pollfd pfd{};
+      pfd.fd     = a.sock;
+      pfd.events = POLLOUT;
+      pfds.push_back(pfd);
+    }
+#ifdef _WIN32
+    int ready = WSAPoll(pfds.data(), static_cast<ULONG>(pfds.size()), wait);
+#else
+    int ready = ::poll(pfds.data(), pfds.size(), wait);
+#endif
+    if (ready < 0) {
+#ifndef _WIN32
+      if (errno == EINTR)
+        continue;
+#endif
+      error_string
+          = "Unable to wait for socket: " + std::string{ strerror(errno) };
+      break;
+    }
+
+    // walk backwards so abandon() keeps the remaining indices valid
+    for (size_t i = attempts.size(); i-- > 0;) {
+      if (pfds[i].revents) {
+        int       error{ 0 };
+        socklen_t length = sizeof(error);
+        if (getsockopt(attempts[i].sock, SOL_SOCKET, SO_ERROR, (char*) &error,
+                       &length)
+                != SOCKET_ERROR
+            && error == 0) {
+          sock = attempts[i].sock;
+          attempts.erase(attempts.begin() + static_cast<std::ptrdiff_t>(i));
+          break;
+        }
+        error_string = "Unable to connect: " + std::string{ strerror(error) };
+        abandon(i);
+      } else if (time_left(attempt_timeout_, attempts[i].started) == 0) {
+        error_string = "Timed out connecting";
+        abandon(i);
+      }
+    }
+  }
+
+  // the losers of the race
+  for (const attempt& a : attempts) {
+    SOCKET s = a.sock;
+    sock_close(s);
+  }
+  if (sock == INVALID_SOCKET) {
+    throw socket_exception{ error_string };
+  }
+  if (!set_socket_blocking(sock, true)) {
+    close();
+    throw socket_exception{ "Unable to change blocking mode: "
+                            + std::string{ strerror(errno) } };
+  }
+  if (timeout_ >= 0)
+    set_socket_timeout(sock, timeout_);
+  // buffering set up before connecting relies on it as well
+  if (write_threshold_)
+    set_nodelay(true);
+  ept_ = std::move(ept);
+}
+
+void tcp_socket::connect(const char* domain, const char* port) {
+  connect({ domain, port });
+}
+
+bool tcp_socket::start_connect(const addrinfo* addr) {
+  close();
+  sock = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+  if (sock == INVALID_SOCKET) {
+    throw socket_exception{ "Unable to open socket" };
+  }
+  set_blocking(false);
+  if (timeout_ >= 0)
+    set_socket_timeout(sock, timeout_);
+  if (write_threshold_)
+    set_nodelay(true);
+  if (::connect(sock, addr->ai_addr, (int) addr->ai_addrlen) == 0)
+    return true;
+#ifdef _WIN32
+  if (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+  if (errno == EINPROGRESS)
+#endif
+    return false;
+  close();
+  throw socket_exception{ "Unable to connect" };
+}
+
+void tcp_socket::finish_connect() {
+  int       error{ 0 };
+  socklen_t length = sizeof(error);
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*) &error, &length)
+          == SOCKET_ERROR
+      || error != 0) {
+    close();
+    throw socket_exception{ "Unable to connect: "
+                            + std::string{ strerror(error) } };
+  }
+}
+
+void tcp_socket::close() {
+  if (!wbuf_.empty() && sock != INVALID_SOCKET) {
+    // best effort, the connection goes away either way
+    try {
+      flush();
+    } catch (...) {
+    }
+  }
+  wbuf_.reset();
+  if (!zerocopy_pending_.empty() && sock != INVALID_SOCKET)
+    poll_zerocopy();
+#ifdef USE_OPENSSL
+  if (ssl) {
+    SSL_shutdown(ssl.get());
+    ssl.reset();
+  }
+  ssl_ctx.reset();
+#endif
+  if (sock != INVALID_SOCKET) {
+    if (zerocopy_pending_.empty()) {
+      sock_close(sock);
+    } else {
+      // completions can only be read while the socket is open
+      shutdown(sock, SD_BOTH);
+      defer_zerocopy(sock, std::exchange(zerocopy_pending_, {}));
+    }
+    sock = INVALID_SOCKET;
+  }
+  blocking_ = true;
+  // the storage goes back to the pool for the next connection
+  rbuf_.reset();
+  frame_checked_ = 0;
+  zerocopy_pending_.clear();
+  zerocopy_threshold_ = 0;
+  zerocopy_seq_       = 0;
+  ept_ = endpoint{};
+}
+
+void tcp_socket::ssl_handshake() {
+#ifdef USE_OPENSSL
+  static const tls_context shared_context{};
+  ssl_handshake(shared_context);
+#else
+  throw ssl_exception{
+    "To use the ssl_handshake function you need to #define USE_OPENSSL"
+  };
+#endif
+}
+
+void tcp_socket::ssl_handshake([[maybe_unused]] const tls_context& ctx) {
+#ifdef USE_OPENSSL
+  // the handshake steps must not block so the timeout covers all of them
+  bool blocking = blocking_;
+  if (blocking)
+    set_blocking(false);
+  try {
+    auto start = std::chrono::steady_clock::now();
+    for (handshake_state state = start_ssl_handshake(ctx);
+         state != HANDSHAKE_DONE; state = continue_ssl_handshake()) {
+      if (!wait_ready(sock, state == HANDSHAKE_WANT_WRITE,
+                      time_left(timeout_, start))) {
+        ssl.reset();
+        ssl_ctx.reset();
+        throw ssl_exception{ "SSL handshake timed out" };
+      }
+    }
+  } catch (...) {
+    if (blocking)
+      set_blocking(true);
+    throw;
+  }
+  if (blocking)
+    set_blocking(true);
+#else
+  throw ssl_exception{
+    "To use the ssl_handshake function you need to #define USE_OPENSSL"
+  };
+#endif
+}
+
+handshake_state tcp_socket::start_ssl_handshake(
+    [[maybe_unused]] const tls_context& ctx) {
+#ifdef USE_OPENSSL
+  ssl.reset(SSL_new(ctx.native_handle()));
+  if (!ssl) {
+    throw ssl_exception{ "Unable to create SSL handle: " + get_ssl_error() };
+  }
+  ssl_ctx = ctx.state_;
+
+  // pair ssl with socket
+  if (!SSL_set_fd(ssl.get(), sock)) {
+    ssl.reset();
+    ssl_ctx.reset();
+    throw ssl_exception{ "Unable to associate SSL and plain socket: "
+                         + get_ssl_error() };
+  }
+  // writes that have to wait are retried from the output buffer
+  SSL_set_mode(ssl.get(), SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  if (ssl_ctx->role == TLS_SERVER) {
+    SSL_set_accept_state(ssl.get());
+    return continue_ssl_handshake();
+  }
+  SSL_set_connect_state(ssl.get());
+
+  if (!ept_.domain.empty()) {
+    // sni, host name check and a session to resume
+    SSL_set_tlsext_host_name(ssl.get(), ept_.domain.c_str());
+    if (ssl_ctx->verify_peer)
+      SSL_set1_host(ssl.get(), ept_.domain.c_str());
+    std::string key = ept_.domain + ":" + std::to_string(ept_.port);
+    if (SSL_SESSION* session = ssl_ctx->find(key)) {
+      SSL_set_session(ssl.get(), session);
+      SSL_SESSION_free(session);
+    }
+    SSL_set_ex_data(ssl.get(), session_key_index(),
+                    new std::string{ std::move(key) });
+  }
+  return continue_ssl_handshake();
+#else
+  throw ssl_exception{
+    "To use the ssl_handshake function you need to #define USE_OPENSSL"
+  };
+#endif
+}
+
+handshake_state tcp_socket::continue_ssl_handshake() {
+#ifdef USE_OPENSSL
+  if (!ssl) {
+    throw ssl_exception{ "No SSL handshake in progress" };
+  }
+  int result = SSL_do_handshake(ssl.get());
+  if (result == 1)
+    return HANDSHAKE_DONE;
+  switch (SSL_get_error(ssl.get(), result)) {
+    case SSL_ERROR_WANT_READ:
+      return HANDSHAKE_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+      return HANDSHAKE_WANT_WRITE;
+    case SSL_ERROR_SSL:
+    default: {
+      std::string error = get_ssl_error();
+      ssl.reset();
+      ssl_ctx.reset();
+      throw ssl_exception{ "Error in SSL handshake: " + error };
+    }
+  }
+#else
+  throw ssl_exception{
+    "To use the ssl_handshake function you need to #define USE_OPENSSL"
+  };
+#endif
+}
+
+void tcp_socket::set_timeout(int timeout_ms) {
+  if (sock != INVALID_SOCKET)
+    set_socket_timeout(sock, timeout_ms);
+  timeout_ = timeout_ms;
+}
+
+int tcp_socket::timeout() const {
+  return timeout_;
+}
+
+void tcp_socket::set_connect_timeout(int timeout_ms, int attempt_timeout_ms) {
+  connect_timeout_ = timeout_ms;
+  attempt_timeout_ = attempt_timeout_ms;
+}
+
+int tcp_socket::connect_timeout() const {
+  return connect_timeout_;
+}
+
+bool tcp_socket::session_reused() const {
+#ifdef USE_OPENSSL
+  return ssl && SSL_session_reused(ssl.get());
+#else
+  return false;
+#endif
+}
+
+bool tcp_socket::ktls_send() const {
+#if defined(USE_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return ssl && BIO_get_ktls_send(SSL_get_wbio(ssl.get()));
+#else
+  return false;
+#endif
+}
+
+bool tcp_socket::ktls_recv() const {
+#if defined(USE_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return ssl && BIO_get_ktls_recv(SSL_get_rbio(ssl.get()));
+#else
+  return false;
+#endif
+}
+
+std::string tcp_socket::alpn_protocol() const {
+#ifdef USE_OPENSSL
+  const unsigned char* protocol{ nullptr };
+  unsigned int         size{ 0 };
+  if (ssl)
+    SSL_get0_alpn_selected(ssl.get(), &protocol, &size);
+  if (protocol)
+    return std::string{ (const char*) protocol, size };
+#endif
+  return "";
+}
+
+std::string tcp_socket::server_name() const {
+#ifdef USE_OPENSSL
+  const char* name{ nullptr };
+  if (ssl)
+    name = SSL_get_servername(ssl.get(), TLSEXT_NAMETYPE_host_name);
+  if (name)
+    return name;
+#endif
+  return "";
+}
+
+int tcp_socket::write(const byte* buffer, size_t size, int flags) {
+  if (write_threshold_) {
+    const const_buffer buffers[]{ { buffer, size } };
+    return write(buffers, flags);
+  }
+  if (is_secure()) {
+    return swrite(buffer, size);
+  } else {
+    return uwrite(buffer, size, flags);
+  }
 }
 
-tcp_socket::tcp_socket(SOCKET s)
-    : ept_{} {
-  sock = s;
+int tcp_socket::write(const byte b) {
+  return write(&b, 1);
 }
 
-std::string tcp_socket::get_ssl_error() {
-#ifdef USE_OPENSSL
-  return std::string{ ERR_error_string(0, nullptr) };
-#else
-  return "";
-#endif
+int tcp_socket::write(const std::string& str) {
+  return write((byte*) str.c_str(), str.length());
 }
 
-endpoint::endpoint()
-    : addr_info{ nullptr }
-    , domain{}
-    , port{} {
+int tcp_socket::writeLine(const std::string& str) {
+  const const_buffer buffers[]{ { (const byte*) str.data(), str.length() },
+                                { (const byte*) "\n", 1 } };
+  return write(buffers);
 }
 
-endpoint::endpoint(const char* domain, const char* port)
-    : endpoint{} {
-  this->domain = domain;
-  this->port   = static_cast<short>(atoi(port));
-  int error    = getaddrinfo(domain, port, nullptr, &addr_info);
-  if (error) {
-    throw socket_exception{ "Error getting address info: "
-                            + std::string{ gai_strerror(error) } };
+int tcp_socket::write(std::span<const const_buffer> buffers, int flags) {
+  if (!write_threshold_)
+    return write_direct(buffers, flags);
+  size_t total{ 0 };
+  for (const const_buffer& buffer : buffers) {
+    total += buffer.size;
+  }
+  if (total >= write_threshold_) {
+    if (flush() < 0)
+      return -1;
+    // anything left over has to go out first
+    if (wbuf_.empty())
+      return write_direct(buffers, flags);
+  }
+  if (wbuf_.empty())
+    buffered_since_ = std::chrono::steady_clock::now();
+  byte* dst = wbuf_.prepare(total);
+  for (const const_buffer& buffer : buffers) {
+    if (buffer.size)
+      memcpy(dst, buffer.data, buffer.size);
+    dst += buffer.size;
+  }
+  wbuf_.commit(total);
+  if (wbuf_.size() >= write_threshold_ || next_flush() == 0) {
+    if (flush() < 0)
+      return -1;
   }
+  return static_cast<int>(total);
 }
 
-endpoint::endpoint(const std::string& domain, const char* port)
-    : endpoint{ domain.c_str(), port } {
+int tcp_socket::write_direct(std::span<const const_buffer> buffers,
+                             int flags) {
+  if (is_secure()) {
+    return swrite(buffers);
+  } else {
+    return uwrite(buffers, flags);
+  }
 }
 
-endpoint::~endpoint() {
-  freeaddrinfo(addr_info);
-  addr_info = nullptr;
+void tcp_socket::set_write_buffer(size_t threshold, int flush_delay_ms) {
+  if (!threshold && flush() < 0) {
+    throw socket_exception{ "Unable to flush output: "
+                            + std::string{ strerror(errno) } };
+  }
+  // sockets connected or accepted later get it there
+  if (threshold && !write_threshold_ && sock != INVALID_SOCKET)
+    set_nodelay(true);
+  write_threshold_ = threshold;
+  flush_delay_     = flush_delay_ms;
 }
 
-endpoint::operator addrinfo*() {
-  return addr_info;
+int tcp_socket::flush() {
+  size_t written{ 0 };
+  while (!wbuf_.empty()) {
+    int sent = is_secure() ? swrite(wbuf_.data(), wbuf_.size())
+                           : uwrite(wbuf_.data(), wbuf_.size());
+    if (sent < 0 && !would_block())
+      return -1;
+    if (sent <= 0)
+      break;
+    wbuf_.consume(static_cast<size_t>(sent));
+    written += static_cast<size_t>(sent);
+  }
+  if (!wbuf_.empty() && written)
+    buffered_since_ = std::chrono::steady_clock::now();
+  return static_cast<int>(written);
 }
 
-wsa_handler base_socket::_wsa_handler = wsa_handler{};
-
-base_socket::base_socket()
-    : sock{ INVALID_SOCKET } {
+size_t tcp_socket::buffered_output() const {
+  return wbuf_.size();
 }
 
-tcp_socket::tcp_socket()
-    : base_socket{}
-    , ept_{}
+size_t tcp_socket::buffered_input() const {
+  size_t buffered = rbuf_.size();
 #ifdef USE_OPENSSL
-    , ssl{ nullptr }
-    , ssl_ctx{ nullptr }
+  if (ssl)
+    buffered += static_cast<size_t>(SSL_pending(ssl.get()));
 #endif
-{
-}
-
-tcp_socket::~tcp_socket() {
-  close();
+  return buffered;
 }
 
-bool tcp_socket::is_valid() const {
-  return sock != INVALID_SOCKET;
+int tcp_socket::next_flush() const {
+  if (wbuf_.empty() || flush_delay_ < 0)
+    return -1;
+  return time_left(flush_delay_, buffered_since_);
 }
 
-bool tcp_socket::is_connected() const {
-  return sock != INVALID_SOCKET;
+void tcp_socket::set_nodelay(bool nodelay) {
+  int value = nodelay ? 1 : 0;
+  if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*) &value,
+                 sizeof(value))
+      == SOCKET_ERROR) {
+    throw socket_exception{ "Unable to set TCP_NODELAY: "
+                            + std::string{ strerror(errno) } };
+  }
 }
 
-bool tcp_socket::is_secure() const {
-#ifdef USE_OPENSSL
-  return ssl != nullptr;
+bool tcp_socket::set_cork(bool cork) {
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+  int value = cork ? 1 : 0;
+#ifdef TCP_CORK
+  int option = TCP_CORK;
+#else
+  int option = TCP_NOPUSH;
+#endif
+  if (setsockopt(sock, IPPROTO_TCP, option, (const char*) &value,
+                 sizeof(value))
+      == SOCKET_ERROR) {
+    throw socket_exception{ "Unable to change cork: "
+                            + std::string{ strerror(errno) } };
+  }
+  return true;
 #else
+  (void) cork;
   return false;
 #endif
 }
 
-void tcp_socket::connect(endpoint ept) {
-  ept_ = ept;
-  std::string error_string{ "" };
-  for (struct addrinfo* cur_addr_info = ept_; cur_addr_info != nullptr;
-       cur_addr_info                  = cur_addr_info->ai_next) {
-    sock = ::socket(cur_addr_info->ai_family, cur_addr_info->ai_socktype,
-                    cur_addr_info->ai_protocol);
-    if (!sock) {
-      error_string = "Unable to open socket";
-      continue;
+void tcp_socket::flush_before_read() {
+  if (!wbuf_.empty())
+    flush();
+}
+
+int tcp_socket::read(byte* buffer, size_t size, int flags) {
+  flush_before_read();
+  if (!rbuf_.empty()) {
+    size_t buffered = std::min(size, rbuf_.size());
+    memcpy(buffer, rbuf_.data(), buffered);
+    if (!(flags & MSG_PEEK)) {
+      rbuf_.consume(buffered);
+      frame_checked_ = 0;
     }
-    if (::connect(sock, cur_addr_info->ai_addr, cur_addr_info->ai_addrlen)) {
-      error_string = "Unable to connect";
-      sock_close(sock);
-      sock = INVALID_SOCKET;
+    return static_cast<int>(buffered);
+  }
+  if (is_secure()) {
+    return sread(buffer, size);
+  } else {
+    return uread(buffer, size, flags);
+  }
+}
+
+int64_t tcp_socket::send_file(int fd, int64_t offset, size_t length) {
+  // buffered output goes first, the file must not overtake it
+  if (flush() < 0 || !wbuf_.empty())
+    return -1;
+  int64_t sent{ 0 };
+#if defined(__linux__)
+  bool zero_copy = !is_secure() || ktls_send();
+  while (zero_copy && (size_t) sent < length) {
+    size_t  chunk = std::min(length - (size_t) sent, size_t{ 1 } << 30);
+    ssize_t written{ 0 };
+#if defined(USE_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (is_secure()) {
+      written = SSL_sendfile(ssl.get(), fd, offset + sent, chunk, 0);
+    } else
+#endif
+    {
+      off_t off = offset + sent;
+      written   = ::sendfile(sock, fd, &off, chunk);
+    }
+    if (written > 0) {
+      sent += written;
+    } else if (written == 0) {
+      return sent; // end of file
+    } else if (errno == EINTR) {
       continue;
+    } else if (errno == EAGAIN) {
+      return sent ? sent : -1;
+    } else if (sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+      zero_copy = false; // file type without sendfile support
+    } else {
+      return sent ? sent : -1;
     }
-    break;
   }
-  if (!sock) {
-    throw socket_exception{ error_string };
+  if ((size_t) sent == length)
+    return sent;
+#endif
+  auto chunk = std::make_unique<byte[]>(file_chunk_size);
+  while ((size_t) sent < length) {
+    size_t size = std::min(length - (size_t) sent, file_chunk_size);
+#ifdef _WIN32
+    if (_lseeki64(fd, offset + sent, SEEK_SET) == -1) {
+      throw socket_exception{ "Unable to seek file" };
+    }
+    int read = _read(fd, chunk.get(), (unsigned int) size);
+#else
+    ssize_t read = ::pread(fd, chunk.get(), size, offset + sent);
+#endif
+    if (read < 0) {
+      throw socket_exception{ "Unable to read file: "
+                              + std::string{ strerror(errno) } };
+    }
+    if (read == 0)
+      return sent;
+    for (size_t done = 0; done < (size_t) read;) {
+      int written = write(chunk.get() + done, (size_t) read - done);
+      if (written <= 0)
+        return sent ? sent : -1;
+      done += written;
+      sent += written;
+    }
   }
+  return sent;
 }
 
-void tcp_socket::connect(const char* domain, const char* port) {
-  connect({ domain, port });
+int64_t tcp_socket::send_file(const std::string& path, int64_t offset,
+                              size_t length) {
+#ifdef _WIN32
+  int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+  if (fd == -1) {
+    throw socket_exception{ "Unable to open file " + path + ": "
+                            + std::string{ strerror(errno) } };
+  }
+  // closes the file on every exit, send_file() throws on socket errors
+  struct file_guard {
+    int fd;
+    ~file_guard() {
+#ifdef _WIN32
+      _close(fd);
+#else
+      ::close(fd);
+#endif
+    }
+  } guard{ fd };
+  struct stat info {};
+  if (fstat(fd, &info) == 0 && info.st_size > offset)
+    length = std::min(length, (size_t) (info.st_size - offset));
+  return send_file(fd, offset, length);
 }
 
-void tcp_socket::close() {
-#ifdef USE_OPENSSL
-  if (ssl) {
-    SSL_shutdown(ssl);
-    SSL_free(ssl);
-    ssl = nullptr;
-  }
-  if (ssl_ctx) {
-    SSL_CTX_free(ssl_ctx);
-    ssl_ctx = nullptr;
+bool tcp_socket::set_zerocopy(bool enable, size_t threshold) {
+#ifdef SOCKETIO_ZEROCOPY
+  int value = enable ? 1 : 0;
+  if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value))
+      == 0) {
+    zerocopy_threshold_ = enable ? std::max<size_t>(threshold, 1) : 0;
+    return enable;
   }
+#else
+  (void) enable;
+  (void) threshold;
 #endif
-  if (sock) {
-    sock_close(sock);
-    sock = INVALID_SOCKET;
-  }
-  ept_ = endpoint{};
+  zerocopy_threshold_ = 0;
+  return false;
 }
 
-void tcp_socket::ssl_handshake() {
-#ifdef USE_OPENSSL
-  static openssl_handler _ssl_handler_life;
-
-  ssl_ctx = SSL_CTX_new(TLS_client_method());
-  if (!ssl_ctx) {
-    throw ssl_exception{ "Unable to create SSL context: " + get_ssl_error() };
+int tcp_socket::write_zerocopy(const byte* buffer, size_t size,
+                               std::function<void()> release) {
+  if (flush() < 0 || !wbuf_.empty()) {
+    release();
+    return -1;
   }
-  ssl = SSL_new(ssl_ctx);
-  if (!ssl) {
-    SSL_CTX_free(ssl_ctx);
-    ssl_ctx = nullptr;
-    throw ssl_exception{ "Unable to create SSL handle: " + get_ssl_error() };
+#ifdef SOCKETIO_ZEROCOPY
+  if (zerocopy_threshold_ && size >= zerocopy_threshold_ && !is_secure()) {
+    uint32_t first = zerocopy_seq_;
+    size_t   sent{ 0 };
+    while (sent < size) {
+      ssize_t written = ::send(sock, buffer + sent, size - sent,
+                               MSG_ZEROCOPY | MSG_NOSIGNAL);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == ENOBUFS && poll_zerocopy(100))
+          continue; // too much pinned memory, wait for completions
+        break;
+      }
+      // every successful call is one completion, even a partial one
+      ++zerocopy_seq_;
+      sent += (size_t) written;
+    }
+    uint32_t calls = zerocopy_seq_ - first;
+    if (calls == 0) {
+      release();
+      return -1;
+    }
+    zerocopy_pending_.push_back(
+        { first, zerocopy_seq_ - 1, calls, std::move(release) });
+    return (int) sent;
   }
-
-  // pair ssl with socket
-  if (!SSL_set_fd(ssl, sock)) {
-    SSL_free(ssl);
-    SSL_CTX_free(ssl_ctx);
-    ssl     = nullptr;
-    ssl_ctx = nullptr;
-    throw ssl_exception{ "Unable to associate SSL and plain socket: "
-                         + get_ssl_error() };
+#endif
+  size_t sent{ 0 };
+  while (sent < size) {
+    int written = write(buffer + sent, size - sent);
+    if (written <= 0)
+      break;
+    sent += (size_t) written;
   }
+  release();
+  return sent ? (int) sent : -1;
+}
 
-  // ssl handshake
-  for (int error = SSL_connect(ssl); error != 1; error = SSL_connect(ssl)) {
-    switch (SSL_get_error(ssl, error)) {
-      case SSL_ERROR_WANT_READ:
-      case SSL_ERROR_WANT_WRITE:
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+size_t tcp_socket::poll_zerocopy(int timeout_ms) {
+  return reap_zerocopy(sock, zerocopy_pending_, timeout_ms);
+}
+
+size_t tcp_socket::reap_zerocopy(SOCKET                     sock,
+                                 std::deque<zerocopy_send>& pending,
+                                 int                        timeout_ms) {
+  size_t released{ 0 };
+#ifdef SOCKETIO_ZEROCOPY
+  while (!pending.empty()) {
+    char    control[128];
+    msghdr  msg{};
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN || released || timeout_ms == 0)
         break;
-      case SSL_ERROR_SSL:
-      default:
-        SSL_free(ssl);
-        SSL_CTX_free(ssl_ctx);
-        ssl     = nullptr;
-        ssl_ctx = nullptr;
-        throw ssl_exception{ "Error in SSL handshake: " + get_ssl_error() };
+      pollfd fd{ sock, 0, 0 }; // errors are always reported
+      if (poll(&fd, 1, timeout_ms) <= 0)
         break;
+      timeout_ms = 0;
+      continue;
+    }
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg          = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+            || (cmsg->cmsg_level == SOL_IPV6
+                && cmsg->cmsg_type == IPV6_RECVERR)))
+        continue;
+      auto* err = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cmsg));
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      // completions cover the inclusive range [ee_info, ee_data]
+      uint32_t lo = err->ee_info;
+      uint32_t hi = err->ee_data;
+      for (auto it = pending.begin(); it != pending.end();) {
+        uint32_t from = std::max(lo, it->first);
+        uint32_t to   = std::min(hi, it->last);
+        if (from <= to)
+          it->remaining -= std::min(it->remaining, to - from + 1);
+        if (it->remaining == 0) {
+          std::function<void()> release = std::move(it->release);
+          it = pending.erase(it);
+          release();
+          ++released;
+        } else {
+          ++it;
+        }
+      }
     }
   }
 #else
-  throw ssl_exception{
-    "To use the ssl_handshake function you need to #define USE_OPENSSL"
-  };
+  (void) sock;
+  (void) timeout_ms;
 #endif
+  return released;
 }
 
-int tcp_socket::write(const byte* buffer, size_t size, int flags) {
+void tcp_socket::defer_zerocopy(SOCKET                    sock,
+                                std::deque<zerocopy_send> pending) {
+  struct closed_socket {
+    SOCKET                    sock;
+    std::deque<zerocopy_send> pending;
+  };
+  struct reaper {
+    std::mutex                 mutex;
+    std::vector<closed_socket> sockets;
+    bool                       running{ false };
+  };
+  // never destroyed, the thread may outlive static destruction
+  static reaper* const r = new reaper{};
+
+  std::lock_guard<std::mutex> lock{ r->mutex };
+  r->sockets.push_back({ sock, std::move(pending) });
+  if (r->running)
+    return;
+  r->running = true;
+  std::thread{ [] {
+    std::vector<closed_socket> sockets;
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock{ r->mutex };
+        std::move(r->sockets.begin(), r->sockets.end(),
+                  std::back_inserter(sockets));
+        r->sockets.clear();
+        if (sockets.empty()) {
+          r->running = false;
+          return;
+        }
+      }
+      std::this_thread::sleep_for(zerocopy_reap_interval);
+      // the kernel completes every send eventually, even when the
+      // connection fails, and the socket is closed once it has
+      for (auto it = sockets.begin(); it != sockets.end();) {
+        reap_zerocopy(it->sock, it->pending, 0);
+        if (it->pending.empty()) {
+          sock_close(it->sock);
+          it = sockets.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  } }.detach();
+}
+
+size_t tcp_socket::zerocopy_pending() const {
+  return zerocopy_pending_.size();
+}
+
+int tcp_socket::read(std::span<const mutable_buffer> buffers, int flags) {
+  flush_before_read();
+  if (!rbuf_.empty()) {
+    size_t buffered{ 0 };
+    for (const mutable_buffer& buffer : buffers) {
+      size_t size = std::min(buffer.size, rbuf_.size() - buffered);
+      memcpy(buffer.data, rbuf_.data() + buffered, size);
+      buffered += size;
+      if (buffered == rbuf_.size())
+        break;
+    }
+    if (!(flags & MSG_PEEK)) {
+      rbuf_.consume(buffered);
+      frame_checked_ = 0;
+    }
+    return static_cast<int>(buffered);
+  }
   if (is_secure()) {
-    return swrite(buffer, size);
+    return sread(buffers);
   } else {
-    return uwrite(buffer, size, flags);
+    return uread(buffers, flags);
   }
 }
 
-int tcp_socket::write(const byte b) {
-  return write(&b, 1);
+byte tcp_socket::read() {
+  if (rbuf_.empty() && fill() <= 0)
+    return byte{};
+  byte b = *rbuf_.data();
+  rbuf_.consume(1);
+  frame_checked_ = 0;
+  return b;
 }
 
-int tcp_socket::write(const std::string& str) {
-  return write((byte*) str.c_str(), str.length());
+std::string tcp_socket::readLine() {
+  return std::string{ readLineView() };
 }
 
-int tcp_socket::writeLine(const std::string& str) {
-  return write((byte*) (str + "\n").c_str(), str.length() + 1);
+std::pmr::string tcp_socket::readLine(std::pmr::memory_resource* resource) {
+  return std::pmr::string{ readLineView(), resource };
 }
 
-int tcp_socket::read(byte* buffer, size_t size, int flags) {
-  if (is_secure()) {
-    return sread(buffer, size);
-  } else {
-    return uread(buffer, size, flags);
+std::string_view tcp_socket::readLineView() {
+  size_t scanned{ 0 };
+  while (true) {
+    const byte* begin = rbuf_.data();
+    const byte* end   = begin + rbuf_.size();
+    if (const byte* newline = find_byte(begin + scanned, end, '\n')) {
+      size_t length = static_cast<size_t>(newline - begin);
+      // the bytes stay in place until the next fill()
+      rbuf_.consume(length + 1);
+      frame_checked_ = 0;
+      return { reinterpret_cast<const char*>(begin), length };
+    }
+    scanned = rbuf_.size();
+    if (fill() <= 0) {
+      throw socket_exception{ "Connection closed while reading line" };
+    }
   }
 }
 
-byte tcp_socket::read() {
-  byte b{};
-  read(&b, 1);
-  return b;
+bool tcp_socket::try_readLine(std::string_view& line) {
+  size_t scanned{ 0 };
+  while (true) {
+    const byte* begin = rbuf_.data();
+    const byte* end   = begin + rbuf_.size();
+    if (const byte* newline = find_byte(begin + scanned, end, '\n')) {
+      size_t length = static_cast<size_t>(newline - begin);
+      rbuf_.consume(length + 1);
+      frame_checked_ = 0;
+      line = { reinterpret_cast<const char*>(begin), length };
+      return true;
+    }
+    scanned  = rbuf_.size();
+    int read = fill();
+    if (read == 0) {
+      throw socket_exception{ "Connection closed while reading line" };
+    }
+    if (read < 0) {
+      if (would_block())
+        return false;
+      throw socket_exception{ "Error reading line: "
+                              + std::to_string(last_socket_error()) };
+    }
+  }
 }
 
-std::string tcp_socket::readLine() {
-  std::string s{};
-  char        c{};
-  while ((c = read()) != '\n') {
-    s.push_back(c);
+std::string_view tcp_socket::read_frame(const framer& f) {
+  std::string_view payload{};
+  while (true) {
+    if (size_t length = f.decode(rbuf_.view(), payload, frame_checked_)) {
+      // the bytes stay in place until the next fill()
+      rbuf_.consume(length);
+      frame_checked_ = 0;
+      return payload;
+    }
+    frame_checked_ = rbuf_.size();
+    if (fill() <= 0) {
+      throw socket_exception{ "Connection closed while reading frame" };
+    }
+  }
+}
+
+bool tcp_socket::try_read_frame(const framer& f, std::string_view& payload) {
+  while (true) {
+    if (size_t length = f.decode(rbuf_.view(), payload, frame_checked_)) {
+      rbuf_.consume(length);
+      frame_checked_ = 0;
+      return true;
+    }
+    // kept for the next call, async readers retry after every wakeup
+    frame_checked_ = rbuf_.size();
+    int read       = fill();
+    if (read == 0) {
+      throw socket_exception{ "Connection closed while reading frame" };
+    }
+    if (read < 0) {
+      if (would_block())
+        return false;
+      throw socket_exception{ "Error reading frame: "
+                              + std::to_string(last_socket_error()) };
+    }
+  }
+}
+
+int tcp_socket::write_frame(const framer& f, std::string_view payload) {
+  byte             header[framer::header_capacity];
+  std::string_view trailer = f.trailer();
+  const_buffer     buffers[]{
+    { header, f.encode_header(payload.size(), header) },
+    { reinterpret_cast<const byte*>(payload.data()), payload.size() },
+    { reinterpret_cast<const byte*>(trailer.data()), trailer.size() }
+  };
+  std::span<const_buffer> pending{ buffers };
+  size_t total = buffers[0].size + buffers[1].size + buffers[2].size;
+  size_t written{ 0 };
+  while (written < total) {
+    int sent = write(pending);
+    if (sent < 0)
+      return written ? static_cast<int>(written) : -1;
+    if (sent == 0)
+      break;
+    written += static_cast<size_t>(sent);
+    // skip what went out, partially sent buffers continue where they stopped
+    size_t left = static_cast<size_t>(sent);
+    while (!pending.empty() && left >= pending.front().size) {
+      left -= pending.front().size;
+      pending = pending.subspan(1);
+    }
+    if (!pending.empty()) {
+      pending.front().data += left;
+      pending.front().size -= left;
+    }
   }
-  return s;
+  return static_cast<int>(written);
+}
+
+int tcp_socket::fill() {
+  flush_before_read();
+  byte* dst  = rbuf_.prepare(read_chunk_size);
+  int   read = is_secure() ? sread(dst, read_chunk_size)
+                           : uread(dst, read_chunk_size);
+  if (read > 0)
+    rbuf_.commit(static_cast<size_t>(read));
+  return read;
 }
 
 int tcp_socket::uwrite(const byte* buffer, size_t size, int flags) {
-  return ::send(sock, (char*) buffer, size, flags);
+  return ::send(sock, (char*) buffer, size, flags | MSG_NOSIGNAL);
 }
 
 int tcp_socket::uread(byte* buffer, size_t size, int flags) {
   return ::recv(sock, (char*) buffer, size, flags);
 }
 
-int tcp_socket::swrite(const byte* buffer, size_t size) {
-#ifdef USE_OPENSSL
-  int written = SSL_write(ssl, (void*) buffer, size);
-  if (written > 0) {
+int tcp_socket::uwrite(std::span<const const_buffer> buffers, int flags) {
+  size_t count = std::min(buffers.size(), max_buffers);
+#ifdef _WIN32
+  WSABUF bufs[max_buffers];
+  for (size_t i = 0; i < count; ++i) {
+    bufs[i].buf = (CHAR*) buffers[i].data;
+    bufs[i].len = (ULONG) buffers[i].size;
+  }
+  DWORD sent{ 0 };
+  if (WSASend(sock, bufs, (DWORD) count, &sent, flags, nullptr, nullptr)
+      == SOCKET_ERROR)
+    return SOCKET_ERROR;
+  return (int) sent;
+#else
+  iovec iov[max_buffers];
+  for (size_t i = 0; i < count; ++i) {
+    iov[i].iov_base = (void*) buffers[i].data;
+    iov[i].iov_len  = buffers[i].size;
+  }
+  msghdr msg{};
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = count;
+  return (int) ::sendmsg(sock, &msg, flags | MSG_NOSIGNAL);
+#endif
+}
+
+int tcp_socket::uread(std::span<const mutable_buffer> buffers, int flags) {
+  size_t count = std::min(buffers.size(), max_buffers);
+#ifdef _WIN32
+  WSABUF bufs[max_buffers];
+  for (size_t i = 0; i < count; ++i) {
+    bufs[i].buf = (CHAR*) buffers[i].data;
+    bufs[i].len = (ULONG) buffers[i].size;
+  }
+  DWORD received{ 0 };
+  DWORD in_flags = flags;
+  if (WSARecv(sock, bufs, (DWORD) count, &received, &in_flags, nullptr,
+              nullptr)
+      == SOCKET_ERROR)
+    return SOCKET_ERROR;
+  return (int) received;
+#else
+  iovec iov[max_buffers];
+  for (size_t i = 0; i < count; ++i) {
+    iov[i].iov_base = buffers[i].data;
+    iov[i].iov_len  = buffers[i].size;
+  }
+  msghdr msg{};
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = count;
+  return (int) ::recvmsg(sock, &msg, flags);
+#endif
+}
+
+int tcp_socket::swrite(std::span<const const_buffer> buffers) {
+  // the kernel frames records itself, no need to coalesce
+  if (ktls_send())
+    return uwrite(buffers);
+
+  byte   record[tls_record_size];
+  size_t filled{ 0 };
+  int    total{ 0 };
+
+  auto flush = [&]() {
+    int written = swrite(record, filled);
+    filled      = 0;
     return written;
-  } else {
-    switch (SSL_get_error(ssl, written)) {
+  };
+
+  for (const const_buffer& buffer : buffers) {
+    const byte* data = buffer.data;
+    size_t      left = buffer.size;
+    if (filled == 0 && left >= tls_record_size) {
+      // large buffers fill whole records on their own, skip the copy
+      int written = swrite(data, left);
+      if (written <= 0)
+        return total ? total : written;
+      total += written;
+      if ((size_t) written < left)
+        return total;
+      continue;
+    }
+    while (left) {
+      size_t size = std::min(left, tls_record_size - filled);
+      memcpy(record + filled, data, size);
+      filled += size;
+      data += size;
+      left -= size;
+      if (filled == tls_record_size) {
+        size_t pending = filled;
+        int    written = flush();
+        if (written <= 0)
+          return total ? total : written;
+        total += written;
+        if ((size_t) written < pending)
+          return total;
+      }
+    }
+  }
+  if (filled) {
+    int written = flush();
+    if (written <= 0)
+      return total ? total : written;
+    total += written;
+  }
+  return total;
+}
+
+int tcp_socket::sread(std::span<const mutable_buffer> buffers) {
+  int total{ 0 };
+  for (const mutable_buffer& buffer : buffers) {
+    int read = sread(buffer.data, buffer.size);
+    if (read <= 0)
+      return total ? total : read;
+    total += read;
+    // only continue with data that is already decrypted
+#ifdef USE_OPENSSL
+    if ((size_t) read < buffer.size || SSL_pending(ssl.get()) == 0)
+      break;
+#else
+    break;
+#endif
+  }
+  return total;
+}
+
+int tcp_socket::swrite([[maybe_unused]] const byte* buffer,
+                       [[maybe_unused]] size_t size) {
+#ifdef USE_OPENSSL
+  bool retained = buffer == wbuf_.data();
+  if (!retained && !wbuf_.empty()) {
+    // a record kept for retrying has to go out before anything else
+    if (flush() < 0)
+      return -1;
+    if (!wbuf_.empty())
+      return want_retry();
+  }
+  auto start = std::chrono::steady_clock::now();
+  while (true) {
+    int written = SSL_write(ssl.get(), (void*) buffer, size);
+    if (written > 0)
+      return written;
+    int error = SSL_get_error(ssl.get(), written);
+    switch (error) {
       case SSL_ERROR_ZERO_RETURN: // The socket has been closed on the other end
         close();
-        throw sock_exception{ "The socket disconnected" };
+        throw socket_exception{ "The socket disconnected" };
         break;
       case SSL_ERROR_WANT_READ:
       case SSL_ERROR_WANT_WRITE:
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if (!blocking_) {
+          if (retained)
+            return want_retry();
+          // OpenSSL has committed to these bytes and the retry has to
+          // present them again, keep them and count them as written
+          if (wbuf_.empty())
+            buffered_since_ = std::chrono::steady_clock::now();
+          memcpy(wbuf_.prepare(size), buffer, size);
+          wbuf_.commit(size);
+          return static_cast<int>(size);
+        }
+        if (!wait_ready(sock, error == SSL_ERROR_WANT_WRITE,
+                        time_left(timeout_, start))) {
+          throw ssl_exception{ "Timed out sending socket" };
+        }
         break;
       default:
         throw ssl_exception{ "Error sending socket: " + get_ssl_error() };
@@ -319,20 +2310,29 @@ int tcp_socket::swrite(const byte* buffer, size_t size) {
   return 0;
 }
 
-int tcp_socket::sread(byte* buffer, size_t size) {
+int tcp_socket::sread([[maybe_unused]] byte* buffer,
+                      [[maybe_unused]] size_t size) {
 #ifdef USE_OPENSSL
-  size_t read_size = SSL_read(ssl, (void*) buffer, size);
-  if (read_size > 0) {
-    return read_size;
-  } else {
-    switch (SSL_get_error(ssl, read_size)) {
+  auto start = std::chrono::steady_clock::now();
+  while (true) {
+    int read_size = SSL_read(ssl.get(), (void*) buffer, size);
+    if (read_size > 0)
+      return read_size;
+    int error = SSL_get_error(ssl.get(), read_size);
+    switch (error) {
       case SSL_ERROR_ZERO_RETURN:
-        disconnect();
+        close();
         return 0;
         break;
       case SSL_ERROR_WANT_READ:
       case SSL_ERROR_WANT_WRITE:
-        return 0;
+        // 0 stays reserved for the peer closing the connection
+        if (!blocking_)
+          return want_retry();
+        if (!wait_ready(sock, error == SSL_ERROR_WANT_WRITE,
+                        time_left(timeout_, start))) {
+          throw ssl_exception{ "Timed out reading socket" };
+        }
         break;
       default:
         throw ssl_exception("Error reading socket: " + get_ssl_error());
@@ -343,18 +2343,53 @@ int tcp_socket::sread(byte* buffer, size_t size) {
   return -1;
 }
 
-tcp_server_socket::tcp_server_socket(const char* port) {
-  endpoint e{ "localhost", port };
-  sock = ::socket(((addrinfo*) e)->ai_family, ((addrinfo*) e)->ai_socktype,
-                  ((addrinfo*) e)->ai_protocol);
+tcp_server_socket::tcp_server_socket(const char* port)
+    : tcp_server_socket{ "localhost", port } {
+}
+
+tcp_server_socket::tcp_server_socket(const char* address, const char* port,
+                                     int backlog, bool reuse_port) {
+  addrinfo hints{};
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = AI_PASSIVE;
+  addrinfo* addr{ nullptr };
+  if (address && !*address)
+    address = nullptr;
+  int error = getaddrinfo(address, port, &hints, &addr);
+  if (error) {
+    throw socket_exception{ "Error getting address info: "
+                            + std::string{ gai_strerror(error) } };
+  }
+  std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addr_guard{
+    addr, &freeaddrinfo
+  };
+
+  sock = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
   if (sock == INVALID_SOCKET) {
     throw socket_exception{ "could not create socket" };
   }
-  if (::bind(sock, ((addrinfo*) e)->ai_addr,
-             (int) ((addrinfo*) e)->ai_addrlen)) {
+  if (reuse_port) {
+#ifdef SO_REUSEPORT
+    int enable{ 1 };
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*) &enable,
+                   sizeof(enable))
+        == SOCKET_ERROR) {
+      close();
+      throw socket_exception{ "could not enable SO_REUSEPORT: "
+                              + std::string{ strerror(errno) } };
+    }
+#else
+    close();
+    throw socket_exception{ "SO_REUSEPORT is not supported" };
+#endif
+  }
+  if (::bind(sock, addr->ai_addr, (int) addr->ai_addrlen)) {
+    close();
     throw socket_exception{ "could not bind to port" };
   }
-  if (::listen(sock, SOMAXCONN) == SOCKET_ERROR) {
+  if (::listen(sock, backlog) == SOCKET_ERROR) {
+    close();
     throw socket_exception{ "could not listen" };
   }
 }
@@ -363,16 +2398,59 @@ tcp_server_socket::~tcp_server_socket() {
   close();
 }
 
+tcp_server_socket::tcp_server_socket(tcp_server_socket&& other) noexcept
+    : base_socket{ std::move(other) } {
+}
+
+tcp_server_socket&
+tcp_server_socket::operator=(tcp_server_socket&& other) noexcept {
+  if (this != &other) {
+    close();
+    base_socket::operator=(std::move(other));
+  }
+  return *this;
+}
+
 [[nodiscard]] tcp_socket tcp_server_socket::accept() {
   SOCKET s{ INVALID_SOCKET };
   s = ::accept(sock, NULL, NULL);
   if (s == INVALID_SOCKET) {
     throw socket_exception{ "failed to accept connection" };
   }
-  return { s };
+  tcp_socket accepted{ s };
+#ifdef _WIN32
+  // accepted sockets inherit the blocking mode of the listening socket
+  accepted.blocking_ = blocking_;
+#endif
+  return accepted;
+}
+
+bool tcp_server_socket::try_accept(tcp_socket& sock) {
+  SOCKET s = ::accept(this->sock, NULL, NULL);
+  if (s == INVALID_SOCKET) {
+#ifdef _WIN32
+    if (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+        || errno == ECONNABORTED)
+#endif
+      return false;
+    throw socket_exception{ "failed to accept connection" };
+  }
+  sock.close();
+  sock.sock = s;
+#ifdef _WIN32
+  sock.blocking_ = blocking_;
+#endif
+  if (sock.write_threshold_)
+    sock.set_nodelay(true);
+  return true;
 }
 
 void tcp_server_socket::close() {
-  ::sock_close(sock);
+  if (sock != INVALID_SOCKET) {
+    ::sock_close(sock);
+    sock = INVALID_SOCKET;
+  }
 }
 } // namespace socketio
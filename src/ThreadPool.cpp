@@ -0,0 +1,119 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace {
+// pool and index of the worker running on this thread
+thread_local const socketio::thread_pool* current_pool{ nullptr };
+thread_local size_t                       current_index{ 0 };
+} // namespace
+
+namespace socketio {
+thread_pool::thread_pool(size_t threads)
+    : workers_{}
+    , sleep_mutex_{}
+    , wake_{}
+    , pending_{ 0 }
+    , next_{ 0 }
+    , stopping_{ false } {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.push_back(std::make_unique<worker>());
+  }
+  // all queues exist before the first worker can steal
+  for (size_t i = 0; i < threads; ++i) {
+    workers_[i]->thread = std::thread{ [this, i] { run(i); } };
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock{ sleep_mutex_ };
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& w : workers_) {
+    w->thread.join();
+  }
+}
+
+void thread_pool::post(task t) {
+  post(any_worker, std::move(t));
+}
+
+void thread_pool::post(size_t index, task t) {
+  if (index >= workers_.size()) {
+    index = current_pool == this ? current_index
+                                 : next_.fetch_add(1) % workers_.size();
+  }
+  // counted first so a worker that pops it never sees the count wrap
+  pending_.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> lock{ workers_[index]->mutex };
+    workers_[index]->tasks.push_back(std::move(t));
+  }
+  {
+    // pairs with the check in run() so the notification can't get lost
+    std::lock_guard<std::mutex> lock{ sleep_mutex_ };
+  }
+  wake_.notify_one();
+}
+
+thread_pool::scheduler thread_pool::schedule(size_t worker) {
+  return { *this, worker };
+}
+
+size_t thread_pool::size() const {
+  return workers_.size();
+}
+
+size_t thread_pool::current_worker() const {
+  return current_pool == this ? current_index : any_worker;
+}
+
+bool thread_pool::pop(size_t index, task& t) {
+  worker&                     w = *workers_[index];
+  std::lock_guard<std::mutex> lock{ w.mutex };
+  if (w.tasks.empty())
+    return false;
+  t = std::move(w.tasks.front());
+  w.tasks.pop_front();
+  return true;
+}
+
+bool thread_pool::steal(size_t index, task& t) {
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    worker& victim = *workers_[(index + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock{ victim.mutex };
+    if (!victim.tasks.empty()) {
+      // the newest task is the one its owner would get to last
+      t = std::move(victim.tasks.back());
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void thread_pool::run(size_t index) {
+  current_pool  = this;
+  current_index = index;
+  task t{};
+  while (true) {
+    if (pop(index, t) || steal(index, t)) {
+      pending_.fetch_sub(1);
+      t();
+      t = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock{ sleep_mutex_ };
+    if (pending_.load() > 0)
+      continue;
+    if (stopping_)
+      break;
+    wake_.wait(lock, [this] { return stopping_ || pending_.load() > 0; });
+  }
+  current_pool = nullptr;
+}
+} // namespace socketio
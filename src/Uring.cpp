@@ -0,0 +1,774 @@
+#include "Uring.hpp"
+
+#include <atomic>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define SOCKETIO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+enum op_kind : int {
+  ACCEPT,
+  RECV,
+  SEND,
+  READ_FIXED,
+  WRITE_FIXED,
+  RECV_STREAM,
+  CANCEL
+};
+
+#ifdef SOCKETIO_URING
+constexpr unsigned short recv_buffer_group = 0;
+// user_data of the poll on the fallback loop, operations are never null
+constexpr __u64 fallback_poll = 0;
+// user_data of the cancellations drain_ring() submits, operations are aligned
+constexpr __u64 drain_cancel = 1;
+
+template <typename T>
+T load_acquire(T* p) {
+  return std::atomic_ref<T>{ *p }.load(std::memory_order_acquire);
+}
+
+template <typename T>
+void store_release(T* p, T value) {
+  std::atomic_ref<T>{ *p }.store(value, std::memory_order_release);
+}
+#endif
+} // namespace
+
+namespace socketio {
+struct uring::operation {
+  int         kind;
+  tcp_socket* sock;
+  SOCKET      fd;
+  byte*       buffer;
+  size_t      size;
+  unsigned    index;
+  bool        multishot;
+
+  completion     on_complete;
+  accept_handler on_accept;
+  recv_handler   on_recv;
+
+  // receive buffer of read_stream() when no kernel buffers are used
+  std::unique_ptr<byte[]> scratch;
+};
+
+#ifdef SOCKETIO_URING
+struct uring::ring {
+  int          fd{ -1 };
+  unsigned int entries{ 0 };
+
+  void*         sq_map{ nullptr };
+  size_t        sq_map_size{ 0 };
+  void*         cq_map{ nullptr };
+  size_t        cq_map_size{ 0 };
+  io_uring_sqe* sqes{ nullptr };
+  size_t        sqes_size{ 0 };
+
+  unsigned*     sq_head{ nullptr };
+  unsigned*     sq_tail{ nullptr };
+  unsigned*     sq_mask{ nullptr };
+  unsigned*     sq_array{ nullptr };
+  unsigned*     cq_head{ nullptr };
+  unsigned*     cq_tail{ nullptr };
+  unsigned*     cq_mask{ nullptr };
+  io_uring_cqe* cqes{ nullptr };
+
+  unsigned int to_submit{ 0 };
+
+  io_uring_buf*           buf_ring{ nullptr };
+  size_t                  buf_ring_size{ 0 };
+  std::unique_ptr<byte[]> buf_memory{};
+
+  bool multishot_accept{ true };
+  bool multishot_recv{ true };
+
+  ~ring() {
+    if (buf_ring)
+      munmap(buf_ring, buf_ring_size);
+    if (sqes)
+      munmap(sqes, sqes_size);
+    if (cq_map && cq_map != sq_map)
+      munmap(cq_map, cq_map_size);
+    if (sq_map)
+      munmap(sq_map, sq_map_size);
+    if (fd != -1)
+      ::close(fd);
+  }
+
+  bool setup(unsigned int size) {
+    io_uring_params params{};
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, size, &params));
+    if (fd < 0) {
+      fd = -1;
+      return false;
+    }
+    entries = params.sq_entries;
+
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size
+        = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+
+    sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+      sq_map = nullptr;
+      return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_map = sq_map;
+    } else {
+      cq_map = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq_map == MAP_FAILED) {
+        cq_map = nullptr;
+        return false;
+      }
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes_map == MAP_FAILED)
+      return false;
+    sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+    auto* sq  = static_cast<byte*>(sq_map);
+    auto* cq  = static_cast<byte*>(cq_map);
+    sq_head   = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail   = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask   = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array  = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head   = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail   = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask   = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes      = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    setup_buffer_ring();
+    return true;
+  }
+
+  /**
+   * @brief registers the kernel provided receive buffers (Linux 5.19+)
+   *
+   */
+  void setup_buffer_ring() {
+    buf_ring_size = recv_buffer_count * sizeof(io_uring_buf);
+    void* map     = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (map == MAP_FAILED) {
+      buf_ring_size = 0;
+      return;
+    }
+    // io_uring_buf_ring::bufs is not usable from C++ (its flexible array
+    // helper shifts it), the tail overlays the first entry's resv field
+    buf_ring = static_cast<io_uring_buf*>(map);
+    buf_memory
+        = std::make_unique<byte[]>(recv_buffer_count * recv_buffer_size);
+    // fill the ring before the kernel pins its pages
+    for (unsigned short bid = 0; bid < recv_buffer_count; ++bid) {
+      io_uring_buf& buf = buf_ring[bid];
+      buf.addr          = reinterpret_cast<__u64>(buffer(bid));
+      buf.len           = recv_buffer_size;
+      buf.bid           = bid;
+    }
+    store_release(&buf_ring->resv, static_cast<__u16>(recv_buffer_count));
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr    = reinterpret_cast<__u64>(map);
+    reg.ring_entries = recv_buffer_count;
+    reg.bgid         = recv_buffer_group;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg,
+                1)
+        != 0) {
+      munmap(map, buf_ring_size);
+      buf_ring         = nullptr;
+      buf_ring_size    = 0;
+      multishot_accept = false;
+      multishot_recv   = false;
+      buf_memory.reset();
+    }
+  }
+
+  byte* buffer(unsigned short bid) {
+    return buf_memory.get() + bid * recv_buffer_size;
+  }
+
+  /**
+   * @brief hands a consumed receive buffer back to the kernel
+   *
+   * @param bid
+   */
+  void recycle_buffer(unsigned short bid) {
+    __u16         tail = buf_ring->resv;
+    io_uring_buf& buf  = buf_ring[tail & (recv_buffer_count - 1)];
+    buf.addr           = reinterpret_cast<__u64>(buffer(bid));
+    buf.len            = recv_buffer_size;
+    buf.bid            = bid;
+    store_release(&buf_ring->resv, static_cast<__u16>(tail + 1));
+  }
+
+  int enter(unsigned int submit, unsigned int wait, unsigned int flags) {
+    int result;
+    do {
+      result = static_cast<int>(syscall(__NR_io_uring_enter, fd, submit,
+                                        wait, flags, nullptr, 0));
+    } while (result < 0 && errno == EINTR);
+    return result;
+  }
+
+  void flush() {
+    while (to_submit) {
+      int submitted = enter(to_submit, 0, 0);
+      if (submitted < 0) {
+        throw socket_exception{ "Error submitting to io_uring: "
+                                + std::string{ strerror(errno) } };
+      }
+      to_submit -= static_cast<unsigned int>(submitted);
+    }
+  }
+
+  /**
+   * @brief next free submission entry (flushes if the queue is full)
+   * @note call push() once it is filled
+   * @return io_uring_sqe*
+   */
+  io_uring_sqe* next() {
+    unsigned tail = *sq_tail;
+    if (tail - load_acquire(sq_head) >= entries)
+      flush();
+    unsigned      index = tail & *sq_mask;
+    io_uring_sqe* sqe   = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    return sqe;
+  }
+
+  void push() {
+    store_release(sq_tail, *sq_tail + 1);
+    ++to_submit;
+  }
+};
+#else
+struct uring::ring {};
+#endif
+
+uring::uring(unsigned int entries)
+    : ring_{}
+    , fallback_{}
+    , queues_{}
+    , in_ring_{}
+    , buffers_{}
+    , in_flight_{ 0 }
+    , stopped_{ false }
+    , fallback_polled_{ false } {
+#ifdef SOCKETIO_URING
+  auto r = std::make_unique<ring>();
+  if (r->setup(entries))
+    ring_ = std::move(r);
+#endif
+}
+
+uring::~uring() {
+  // the kernel may still write into buffers of in-flight requests
+  drain_ring();
+  ring_.reset();
+  for (auto& [fd, queue] : queues_) {
+    for (operation* op : queue.reads)
+      delete op;
+    for (operation* op : queue.writes)
+      delete op;
+  }
+}
+
+bool uring::is_supported() const {
+  return ring_ != nullptr;
+}
+
+bool uring::has_multishot() const {
+#ifdef SOCKETIO_URING
+  return ring_ && ring_->buf_ring && ring_->multishot_recv;
+#else
+  return false;
+#endif
+}
+
+void uring::register_buffers(
+    const std::vector<std::pair<byte*, size_t>>& buffers) {
+  buffers_ = buffers;
+#ifdef SOCKETIO_URING
+  if (!ring_)
+    return;
+  syscall(__NR_io_uring_register, ring_->fd, IORING_UNREGISTER_BUFFERS,
+          nullptr, 0);
+  std::vector<iovec> iovecs{};
+  iovecs.reserve(buffers.size());
+  for (const auto& [data, size] : buffers)
+    iovecs.push_back({ data, size });
+  if (syscall(__NR_io_uring_register, ring_->fd, IORING_REGISTER_BUFFERS,
+              iovecs.data(), static_cast<unsigned int>(iovecs.size()))
+      != 0) {
+    throw socket_exception{ "Unable to register buffers: "
+                            + std::string{ strerror(errno) } };
+  }
+#endif
+}
+
+uring::operation* uring::make(int kind, tcp_socket* sock, SOCKET fd) {
+  auto* op      = new operation{};
+  op->kind      = kind;
+  op->sock      = sock;
+  op->fd        = fd;
+  op->buffer    = nullptr;
+  op->size      = 0;
+  op->index     = 0;
+  op->multishot = false;
+  ++in_flight_;
+  return op;
+}
+
+void uring::finish(operation* op) {
+  --in_flight_;
+  delete op;
+}
+
+void uring::accept(tcp_server_socket& server, accept_handler handler) {
+  operation* op = make(ACCEPT, nullptr, server.native_handle());
+  op->on_accept = std::move(handler);
+  start(op);
+}
+
+void uring::read(tcp_socket& sock, byte* buffer, size_t size,
+                 completion handler) {
+  operation* op   = make(RECV, &sock, sock.native_handle());
+  op->buffer      = buffer;
+  op->size        = size;
+  op->on_complete = std::move(handler);
+  start(op);
+}
+
+void uring::write(tcp_socket& sock, const byte* buffer, size_t size,
+                  completion handler) {
+  operation* op   = make(SEND, &sock, sock.native_handle());
+  op->buffer      = const_cast<byte*>(buffer);
+  op->size        = size;
+  op->on_complete = std::move(handler);
+  start(op);
+}
+
+void uring::read_fixed(tcp_socket& sock, unsigned int index, size_t offset,
+                       size_t size, completion handler) {
+  if (index >= buffers_.size() || offset + size > buffers_[index].second) {
+    throw socket_exception{ "Registered buffer out of range" };
+  }
+  operation* op   = make(READ_FIXED, &sock, sock.native_handle());
+  op->buffer      = buffers_[index].first + offset;
+  op->size        = size;
+  op->index       = index;
+  op->on_complete = std::move(handler);
+  start(op);
+}
+
+void uring::write_fixed(tcp_socket& sock, unsigned int index, size_t offset,
+                        size_t size, completion handler) {
+  if (index >= buffers_.size() || offset + size > buffers_[index].second) {
+    throw socket_exception{ "Registered buffer out of range" };
+  }
+  operation* op   = make(WRITE_FIXED, &sock, sock.native_handle());
+  op->buffer      = buffers_[index].first + offset;
+  op->size        = size;
+  op->index       = index;
+  op->on_complete = std::move(handler);
+  start(op);
+}
+
+void uring::read_stream(tcp_socket& sock, recv_handler handler) {
+  operation* op = make(RECV_STREAM, &sock, sock.native_handle());
+  op->on_recv   = std::move(handler);
+  start(op);
+}
+
+void uring::start(operation* op) {
+#ifdef SOCKETIO_URING
+  if (ring_ && !(op->sock && op->sock->is_secure())) {
+    io_uring_sqe* sqe = ring_->next();
+    sqe->fd           = op->fd;
+    sqe->user_data    = reinterpret_cast<__u64>(op);
+    switch (op->kind) {
+      case ACCEPT:
+        sqe->opcode   = IORING_OP_ACCEPT;
+        op->multishot = ring_->multishot_accept;
+        if (op->multishot)
+          sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+        break;
+      case RECV:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr   = reinterpret_cast<__u64>(op->buffer);
+        sqe->len    = static_cast<__u32>(op->size);
+        break;
+      case SEND:
+        sqe->opcode    = IORING_OP_SEND;
+        sqe->addr      = reinterpret_cast<__u64>(op->buffer);
+        sqe->len       = static_cast<__u32>(op->size);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+      case READ_FIXED:
+      case WRITE_FIXED:
+        sqe->opcode = op->kind == READ_FIXED ? IORING_OP_READ_FIXED
+                                             : IORING_OP_WRITE_FIXED;
+        sqe->addr      = reinterpret_cast<__u64>(op->buffer);
+        sqe->len       = static_cast<__u32>(op->size);
+        sqe->buf_index = static_cast<__u16>(op->index);
+        sqe->off       = static_cast<__u64>(-1);
+        break;
+      case RECV_STREAM:
+        sqe->opcode = IORING_OP_RECV;
+        if (ring_->buf_ring) {
+          sqe->flags |= IOSQE_BUFFER_SELECT;
+          sqe->buf_group = recv_buffer_group;
+          op->multishot  = ring_->multishot_recv;
+          if (op->multishot)
+            sqe->ioprio |= IORING_RECV_MULTISHOT;
+        } else {
+          if (!op->scratch)
+            op->scratch = std::make_unique<byte[]>(recv_buffer_size);
+          sqe->addr = reinterpret_cast<__u64>(op->scratch.get());
+          sqe->len  = recv_buffer_size;
+        }
+        break;
+      case CANCEL:
+        sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        break;
+    }
+    ring_->push();
+    in_ring_.insert(op);
+    return;
+  }
+#endif
+  if (op->kind == CANCEL) {
+    finish(op);
+    return;
+  }
+  enqueue_fallback(op);
+}
+
+void uring::complete(operation* op, int result, unsigned int flags) {
+#ifdef SOCKETIO_URING
+  bool more = flags & IORING_CQE_F_MORE;
+  switch (op->kind) {
+    case ACCEPT:
+      if (result == -EINVAL && op->multishot) {
+        // kernel without multishot accept
+        ring_->multishot_accept = false;
+        start(op);
+        return;
+      }
+      if (result < 0) {
+        op->on_accept(result, tcp_socket{});
+        if (!more)
+          finish(op);
+        return;
+      }
+      op->on_accept(result, tcp_socket{ result });
+      if (!more)
+        start(op);
+      return;
+    case RECV_STREAM: {
+      if (result == -EINVAL && op->multishot) {
+        // kernel without multishot recv
+        ring_->multishot_recv = false;
+        start(op);
+        return;
+      }
+      if (result == -ENOBUFS) {
+        // all provided buffers are in use, try again
+        if (!more)
+          start(op);
+        return;
+      }
+      const byte* data = op->scratch.get();
+      if (flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        data               = ring_->buffer(bid);
+        op->on_recv(result, { reinterpret_cast<const char*>(data),
+                              static_cast<size_t>(std::max(result, 0)) });
+        ring_->recycle_buffer(bid);
+      } else {
+        op->on_recv(result,
+                    { reinterpret_cast<const char*>(data),
+                      static_cast<size_t>(std::max(result, 0)) });
+      }
+      if (result <= 0) {
+        if (!more)
+          finish(op);
+      } else if (!more) {
+        start(op);
+      }
+      return;
+    }
+    case CANCEL:
+      finish(op);
+      return;
+    default:
+      op->on_complete(result);
+      finish(op);
+      return;
+  }
+#else
+  (void) op;
+  (void) result;
+  (void) flags;
+#endif
+}
+
+void uring::enqueue_fallback(operation* op) {
+  fallback_queue& queue = queues_[op->fd];
+  if (op->kind == SEND || op->kind == WRITE_FIXED)
+    queue.writes.push_back(op);
+  else
+    queue.reads.push_back(op);
+  update_fallback(op->fd);
+}
+
+void uring::update_fallback(SOCKET fd) {
+  auto it = queues_.find(fd);
+  if (it == queues_.end())
+    return;
+  unsigned int events{ 0 };
+  if (!it->second.reads.empty())
+    events |= READABLE;
+  if (!it->second.writes.empty())
+    events |= WRITABLE;
+  if (!events) {
+    queues_.erase(it);
+    fallback_.remove(fd);
+    return;
+  }
+  fallback_.add(fd, events, [this, fd](unsigned int ready) {
+    handle_fallback(fd, ready);
+  });
+}
+
+void uring::handle_fallback(SOCKET fd, unsigned int events) {
+  auto it = queues_.find(fd);
+  if (it == queues_.end())
+    return;
+  if ((events & (READABLE | CLOSED)) && !it->second.reads.empty()) {
+    operation* op = it->second.reads.front();
+    if (perform_fallback(op)) {
+      it = queues_.find(fd);
+      if (it != queues_.end() && !it->second.reads.empty()
+          && it->second.reads.front() == op)
+        it->second.reads.pop_front();
+      finish(op);
+    }
+  }
+  it = queues_.find(fd);
+  if (it != queues_.end() && (events & (WRITABLE | CLOSED))
+      && !it->second.writes.empty()) {
+    operation* op = it->second.writes.front();
+    if (perform_fallback(op)) {
+      it = queues_.find(fd);
+      if (it != queues_.end() && !it->second.writes.empty()
+          && it->second.writes.front() == op)
+        it->second.writes.pop_front();
+      finish(op);
+    }
+  }
+  update_fallback(fd);
+}
+
+bool uring::perform_fallback(operation* op) {
+  switch (op->kind) {
+    case ACCEPT: {
+      SOCKET s = ::accept(op->fd, nullptr, nullptr);
+      if (s == INVALID_SOCKET) {
+        if (would_block())
+          return false;
+        op->on_accept(-last_socket_error(), tcp_socket{});
+        return true;
+      }
+      op->on_accept(static_cast<int>(s), tcp_socket{ s });
+      return false;
+    }
+    case RECV:
+    case READ_FIXED:
+    case SEND:
+    case WRITE_FIXED: {
+      bool sending = op->kind == SEND || op->kind == WRITE_FIXED;
+      int  result
+          = sending ? op->sock->write(op->buffer, op->size, MSG_DONTWAIT)
+                    : op->sock->read(op->buffer, op->size, MSG_DONTWAIT);
+      if (result < 0) {
+        if (would_block())
+          return false;
+        result = -last_socket_error();
+      }
+      op->on_complete(result);
+      return true;
+    }
+    case RECV_STREAM: {
+      if (!op->scratch)
+        op->scratch = std::make_unique<byte[]>(recv_buffer_size);
+      int result = op->sock->read(op->scratch.get(), recv_buffer_size,
+                                  MSG_DONTWAIT);
+      if (result < 0) {
+        if (would_block())
+          return false;
+        result = -last_socket_error();
+      }
+      op->on_recv(result,
+                  { reinterpret_cast<const char*>(op->scratch.get()),
+                    static_cast<size_t>(std::max(result, 0)) });
+      return result <= 0;
+    }
+  }
+  return true;
+}
+
+void uring::cancel(SOCKET s) {
+  auto it = queues_.find(s);
+  if (it != queues_.end()) {
+    fallback_queue queue = std::move(it->second);
+    queues_.erase(it);
+    fallback_.remove(s);
+    for (operation* op : queue.reads) {
+      if (op->kind == ACCEPT)
+        op->on_accept(-ECANCELED, tcp_socket{});
+      else if (op->kind == RECV_STREAM)
+        op->on_recv(-ECANCELED, {});
+      else
+        op->on_complete(-ECANCELED);
+      finish(op);
+    }
+    for (operation* op : queue.writes) {
+      op->on_complete(-ECANCELED);
+      finish(op);
+    }
+  }
+  if (ring_)
+    start(make(CANCEL, nullptr, s));
+}
+
+void uring::poll_fallback() {
+#ifdef SOCKETIO_URING
+  // secure sockets are served by fallback_, its epoll descriptor turns
+  // readable once one of them is ready
+  if (!ring_ || fallback_polled_ || queues_.empty())
+    return;
+  io_uring_sqe* sqe = ring_->next();
+  sqe->opcode       = IORING_OP_POLL_ADD;
+  sqe->fd           = fallback_.epoll_fd_;
+  sqe->poll_events  = POLLIN;
+  sqe->user_data    = fallback_poll;
+  ring_->push();
+  fallback_polled_ = true;
+#endif
+}
+
+void uring::drain_ring() {
+#ifdef SOCKETIO_URING
+  if (!ring_ || in_ring_.empty())
+    return;
+  try {
+    ring_->flush();
+    for (operation* op : in_ring_) {
+      io_uring_sqe* sqe = ring_->next();
+      sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+      sqe->addr         = reinterpret_cast<__u64>(op);
+      sqe->user_data    = drain_cancel;
+      ring_->push();
+    }
+    ring_->flush();
+  } catch (const socket_exception&) {
+    // without cancellations the requests still complete on their own
+  }
+  // their handlers are not called anymore, the uring is going away
+  while (!in_ring_.empty()) {
+    if (ring_->enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+      break;
+    unsigned head = *ring_->cq_head;
+    unsigned tail = load_acquire(ring_->cq_tail);
+    while (head != tail) {
+      io_uring_cqe cqe = ring_->cqes[head & *ring_->cq_mask];
+      store_release(ring_->cq_head, ++head);
+      if (cqe.user_data == fallback_poll || cqe.user_data == drain_cancel
+          || (cqe.flags & IORING_CQE_F_MORE))
+        continue;
+      auto* op = reinterpret_cast<operation*>(cqe.user_data);
+      if (in_ring_.erase(op)) {
+        --in_flight_;
+        delete op;
+      }
+    }
+  }
+#endif
+}
+
+void uring::submit() {
+#ifdef SOCKETIO_URING
+  if (ring_)
+    ring_->flush();
+#endif
+}
+
+int uring::run_once() {
+#ifdef SOCKETIO_URING
+  if (ring_) {
+    if (!in_flight_)
+      return 0;
+    int handled{ 0 };
+    poll_fallback();
+    // submit and wait with a single syscall
+    int submitted = ring_->enter(ring_->to_submit, 1, IORING_ENTER_GETEVENTS);
+    if (submitted < 0) {
+      throw socket_exception{ "Error waiting on io_uring: "
+                              + std::string{ strerror(errno) } };
+    }
+    ring_->to_submit -= static_cast<unsigned int>(submitted);
+    unsigned head    = *ring_->cq_head;
+    unsigned tail    = load_acquire(ring_->cq_tail);
+    while (head != tail) {
+      io_uring_cqe cqe = ring_->cqes[head & *ring_->cq_mask];
+      store_release(ring_->cq_head, ++head);
+      if (cqe.user_data == fallback_poll) {
+        fallback_polled_ = false;
+        handled += fallback_.run_once(0);
+      } else {
+        auto* op = reinterpret_cast<operation*>(cqe.user_data);
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+          in_ring_.erase(op);
+        complete(op, cqe.res, cqe.flags);
+        ++handled;
+      }
+      if (head == tail)
+        tail = load_acquire(ring_->cq_tail);
+    }
+    return handled;
+  }
+#endif
+  return fallback_.run_once();
+}
+
+void uring::run() {
+  while (!stopped_ && in_flight_) {
+    run_once();
+  }
+  stopped_ = false;
+}
+
+void uring::stop() {
+  stopped_ = true;
+}
+
+size_t uring::pending() const {
+  return in_flight_;
+}
+} // namespace socketio
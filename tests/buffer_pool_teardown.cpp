@@ -0,0 +1,14 @@
+#include "Socket.hpp"
+
+#include <cstdio>
+
+// destroyed after the main thread's thread_local buffer caches
+socketio::byte_buffer leftover;
+
+int main() {
+  // the first allocation creates the thread's cache of the global pool
+  leftover.prepare(1024);
+  leftover.commit(1024);
+  std::puts("buffer released during static destruction");
+  return 0;
+}